@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
@@ -8,17 +9,23 @@
 #include <dirent.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prct.h"
+
+// The demo process tree and interactive menu are left out of the library build
+#ifndef PRCT_LIBRARY
 
 // Global flag for signal handling
 volatile sig_atomic_t keep_running = 1;
 
-// Structure to represent a process
-typedef struct Process {
-    pid_t pid;
-    pid_t ppid;
-    char state;
-} Process;
-
 // Process tree information
 pid_t root_pid;
 pid_t child1_pid, child2_pid;
@@ -56,6 +63,8 @@ pid_t create_zombie() {
     return pid;
 }
 
+#endif // PRCT_LIBRARY
+
 // ------------------------ PRCT FUNCTIONS ------------------------ //
 
 // Function to check if a process exists
@@ -65,311 +74,2405 @@ int process_exists(pid_t pid) {
     return access(path, F_OK) == 0;
 }
 
-// Function to get process information (PPID and state)
-int get_process_info(pid_t pid, Process *proc) {
-    char path[256];
-    FILE *fp;
-    char buffer[1024];
-    char comm[256];
+int read_stat_file(const char *path, Process *proc);
+
+// Function to get process information (PPID and state)
+int get_process_info(pid_t pid, Process *proc) {
+    char path[256];
+
+    proc->pid = pid;
+
+    sprintf(path, "/proc/%d/stat", pid);
+    return read_stat_file(path, proc);
+}
+
+// Function to parse a process or thread stat file (PID is left to the caller)
+int read_stat_file(const char *path, Process *proc) {
+    FILE *fp;
+    char buffer[1024];
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+
+    if (fgets(buffer, sizeof(buffer), fp)) {
+        // Parse the stat file for process info
+        // Format is: pid (comm) state ppid ...
+        // comm may contain spaces or ')' itself, so split on the last ')'
+        char *open = strchr(buffer, '(');
+        char *close = strrchr(buffer, ')');
+        if (!open || !close || close < open) {
+            fclose(fp);
+            return 0;
+        }
+
+        size_t len = close - open - 1;
+        if (len >= sizeof(proc->comm)) {
+            len = sizeof(proc->comm) - 1;
+        }
+        memcpy(proc->comm, open + 1, len);
+        proc->comm[len] = '\0';
+
+        // Fields after comm: state ppid ... utime(14) stime(15) ... num_threads(20)
+        // ... starttime(22) ... rss(24)
+        unsigned long utime = 0, stime = 0;
+        proc->threads = 1;
+        proc->start_ticks = 0;
+        proc->rss_pages = 0;
+        if (sscanf(close + 1, " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu"
+                              " %*d %*d %*d %*d %d %*d %llu %*u %ld",
+                   &proc->state, &proc->ppid, &utime, &stime, &proc->threads,
+                   &proc->start_ticks, &proc->rss_pages) < 2) {
+            fclose(fp);
+            return 0;
+        }
+        proc->cpu_ticks = utime + stime;
+    } else {
+        fclose(fp);
+        return 0;
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+// Function to check if a process is defunct (zombie)
+int is_defunct(pid_t pid) {
+    Process proc;
+    if (!get_process_info(pid, &proc)) {
+        return 0;
+    }
+    return proc.state == 'Z';
+}
+
+// Function to get all processes
+void get_all_processes(Process **processes, int *count) {
+    DIR *dir;
+    struct dirent *entry;
+    pid_t pid;
+
+    *count = 0;
+    *processes = NULL;
+
+    dir = opendir("/proc");
+    if (!dir) {
+        perror("Failed to open /proc");
+        return;
+    }
+
+    while ((entry = readdir(dir))) {
+        // Check if the entry is a directory and named with digits (process ID)
+        if (entry->d_type == DT_DIR && isdigit(entry->d_name[0])) {
+            pid = atoi(entry->d_name);
+
+            *processes = realloc(*processes, (*count + 1) * sizeof(Process));
+            if (get_process_info(pid, &(*processes)[*count])) {
+                (*count)++;
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+// Function to compare processes by PID (for qsort)
+int compare_process_pid(const void *a, const void *b) {
+    pid_t pa = ((const Process *)a)->pid;
+    pid_t pb = ((const Process *)b)->pid;
+    return (pa > pb) - (pa < pb);
+}
+
+// Function to compare PIDs (for qsort)
+int compare_pid(const void *a, const void *b) {
+    pid_t pa = *(const pid_t *)a;
+    pid_t pb = *(const pid_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+// Function to compare doubles (for qsort)
+int compare_double(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Function to sort processes by PID; /proc lists PIDs in ascending order, so
+// this rarely does more than check the order
+void sort_processes_by_pid(Process *processes, int count) {
+    for (int i = 1; i < count; i++) {
+        if (processes[i - 1].pid > processes[i].pid) {
+            qsort(processes, count, sizeof(Process), compare_process_pid);
+            return;
+        }
+    }
+}
+
+// Function to hash a PID into an open-addressing table of mask + 1 slots
+unsigned int hash_pid(pid_t pid, unsigned int mask) {
+    return ((unsigned int)pid * 2654435761u) & mask;
+}
+
+// Function to find the index of a PID in a snapshot, or -1 if it is absent
+int find_process_index(const ProcessTree *tree, pid_t pid) {
+    if (!tree->lookup || pid < 0) {
+        return -1;
+    }
+
+    if (tree->lookup_direct) {
+        return ((unsigned int)pid < tree->lookup_size) ? tree->lookup[pid] : -1;
+    }
+
+    unsigned int mask = tree->lookup_size - 1;
+    for (unsigned int slot = hash_pid(pid, mask); tree->lookup[slot] != -1; slot = (slot + 1) & mask) {
+        if (tree->pid[tree->lookup[slot]] == pid) {
+            return tree->lookup[slot];
+        }
+    }
+    return -1;
+}
+
+// Function to get the PPID of a snapshot entry (roots keep theirs encoded in parent)
+pid_t tree_ppid(const ProcessTree *tree, int node) {
+    int parent = tree->parent[node];
+    return (parent >= 0) ? tree->pid[parent] : -1 - parent;
+}
+
+// Function to get the command name of a snapshot entry ("?" without details)
+const char *tree_comm(const ProcessTree *tree, int node) {
+    return tree->details ? tree->details[node].comm : "?";
+}
+
+// Function to release a snapshot
+void free_process_tree(ProcessTree *tree) {
+    free(tree->pid);
+    free(tree->parent);
+    free(tree->subtree_size);
+    free(tree->state);
+    free(tree->details);
+    free(tree->lookup);
+    memset(tree, 0, sizeof(*tree));
+}
+
+// Function to build the PID lookup table: direct-mapped when PIDs are dense
+// enough that a pid_max-sized table is no bigger than a hash table, otherwise
+// open addressing with linear probing at a load factor of at most 3/4
+int build_pid_lookup(ProcessTree *tree) {
+    const pid_t *pids = tree->pid;
+    int count = tree->count;
+    pid_t max_pid = 0;
+    unsigned int capacity = 16;
+
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > max_pid) {
+            max_pid = pids[i];
+        }
+    }
+    while (capacity < (unsigned int)count + (unsigned int)count / 3 + 1) {
+        capacity *= 2;
+    }
+
+    tree->lookup_direct = (unsigned int)max_pid + 1 <= capacity;
+    tree->lookup_size = tree->lookup_direct ? (unsigned int)max_pid + 1 : capacity;
+    tree->lookup = malloc(tree->lookup_size * sizeof(int));
+    if (!tree->lookup) {
+        return 0;
+    }
+    memset(tree->lookup, 0xff, tree->lookup_size * sizeof(int));
+
+    for (int i = 0; i < count; i++) {
+        if (tree->lookup_direct) {
+            tree->lookup[pids[i]] = i;
+            continue;
+        }
+        unsigned int slot = hash_pid(pids[i], capacity - 1);
+        while (tree->lookup[slot] != -1) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        tree->lookup[slot] = i;
+    }
+    return 1;
+}
+
+// Function to report the resident size of a snapshot, split into the compact
+// tree arrays, the PID lookup table and the optional per-process details
+size_t process_tree_footprint(const ProcessTree *tree, size_t *core, size_t *lookup,
+                              size_t *details) {
+    *core = (size_t)tree->count * (sizeof(pid_t) + 2 * sizeof(int) + sizeof(char));
+    *lookup = (size_t)tree->lookup_size * sizeof(int);
+    *details = tree->details ? (size_t)tree->count * sizeof(ProcessDetails) : 0;
+    return *core + *lookup + *details;
+}
+
+// Function to break parent cycles (possible after PID reuse) by cutting one
+// link per cycle, so that every walk up the parents ends at a root. mark is
+// count bytes of scratch: 0 = unvisited, 1 = on the current path, 2 = known
+// to reach a root.
+void break_parent_cycles(int *parent, char *mark, int count) {
+    for (int i = 0; i < count; i++) {
+        mark[i] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        while (j != -1 && mark[j] == 0) {
+            mark[j] = 1;
+            j = parent[j];
+        }
+        // j is -1 (a root was reached), already settled, or the first node
+        // seen twice, i.e. where the path entered a cycle. Settle the whole
+        // path while the cycle is still intact, then cut it there; cutting
+        // first would leave the rest of the cycle on the path unsettled, and
+        // later walks would cut each of its members again.
+        int cut = (j != -1 && mark[j] == 1) ? j : -1;
+        for (j = i; j != -1 && mark[j] == 1; j = parent[j]) {
+            mark[j] = 2;
+        }
+        if (cut != -1) {
+            parent[cut] = -1;
+        }
+    }
+}
+
+// Function to rewrite processes[] in place as ProcessDetails records in tree
+// order (new_index maps input positions to tree positions and is consumed),
+// so the details never exist twice in memory
+ProcessDetails *compact_process_details(Process *processes, int count, int *new_index) {
+    _Static_assert(sizeof(ProcessDetails) <= sizeof(Process),
+                   "ProcessDetails must fit in the Process it is rewritten over");
+    ProcessDetails *details = (ProcessDetails *)processes;
+
+    // Records only shrink, so copying forward never overwrites unread input
+    for (int i = 0; i < count; i++) {
+        const Process *proc = &processes[i];
+        ProcessDetails det;
+
+        memcpy(det.comm, proc->comm, sizeof(det.comm));
+        det.threads = proc->threads;
+        det.start_ticks = proc->start_ticks;
+        det.cpu_ticks = proc->cpu_ticks;
+        det.rss_pages = proc->rss_pages;
+        details[i] = det;
+    }
+
+    // Apply the permutation one cycle at a time
+    for (int i = 0; i < count; i++) {
+        if (new_index[i] < 0) {
+            continue;
+        }
+        ProcessDetails carry = details[i];
+        int j = new_index[i];
+        new_index[i] = -1;
+        while (j != i) {
+            ProcessDetails next = details[j];
+            int after = new_index[j];
+            details[j] = carry;
+            carry = next;
+            new_index[j] = -1;
+            j = after;
+        }
+        details[i] = carry;
+    }
+
+    ProcessDetails *shrunk = realloc(details, (count + 1) * sizeof(ProcessDetails));
+    return shrunk ? shrunk : details;
+}
+
+// Function to index an array of processes as a tree (takes ownership of
+// processes and frees or reuses it). Processes are laid out in depth-first
+// pre-order with siblings in PID order; details are kept when keep_details is set.
+int build_process_tree(Process *processes, int count, int keep_details, ProcessTree *tree) {
+    memset(tree, 0, sizeof(*tree));
+    sort_processes_by_pid(processes, count);
+
+    // Only two temporaries are allocated; the rest of the scratch space is
+    // borrowed from output arrays that are not filled in yet
+    int *parent = malloc((count + 1) * sizeof(int));
+    int *first_child = malloc((count + 1) * sizeof(int));
+
+    tree->count = count;
+    tree->pid = malloc((count + 1) * sizeof(pid_t));
+    tree->parent = malloc((count + 1) * sizeof(int));
+    tree->subtree_size = malloc((count + 1) * sizeof(int));
+    tree->state = malloc(count + 1);
+
+    int ok = parent && first_child && tree->pid && tree->parent && tree->subtree_size &&
+             tree->state;
+    if (ok) {
+        // Index by input position for now; renumbered once the layout is known
+        for (int i = 0; i < count; i++) {
+            tree->pid[i] = processes[i].pid;
+        }
+        ok = build_pid_lookup(tree);
+    }
+    if (!ok) {
+        perror("Failed to index process tree");
+        free(parent);
+        free(first_child);
+        free(processes);
+        free_process_tree(tree);
+        return 0;
+    }
+
+    // A parent that started after its child is a recycled PID, not the parent
+    for (int i = 0; i < count; i++) {
+        int p = find_process_index(tree, processes[i].ppid);
+        parent[i] = (p == i || (p >= 0 && processes[p].start_ticks > processes[i].start_ticks))
+                        ? -1 : p;
+    }
+
+    // Break parent cycles (possible after PID reuse) so every walk terminates
+    break_parent_cycles(parent, tree->state, count);
+
+    // Child lists as linked lists in PID order (insert from the highest PID down)
+    int *next_sibling = tree->subtree_size;
+    for (int i = 0; i < count; i++) {
+        first_child[i] = -1;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        if (parent[i] != -1) {
+            next_sibling[i] = first_child[parent[i]];
+            first_child[parent[i]] = i;
+        }
+    }
+
+    // Pre-order walk from every root; next_sibling doubles as the walk's
+    // continuation, so the only extra memory is order[] itself
+    int *order = tree->parent;
+    int placed = 0;
+    for (int root = 0; root < count; root++) {
+        if (parent[root] != -1) {
+            continue;
+        }
+        int node = root;
+        while (node != -1) {
+            order[placed++] = node;
+            if (first_child[node] != -1) {
+                node = first_child[node];
+                continue;
+            }
+            // Climb until an ancestor (below the root) has a next sibling
+            while (node != root && next_sibling[node] == -1) {
+                node = parent[node];
+            }
+            node = (node == root) ? -1 : next_sibling[node];
+        }
+    }
+
+    // Renumber: first_child is reused as the old -> new index map
+    int *new_index = first_child;
+    for (int k = 0; k < count; k++) {
+        new_index[order[k]] = k;
+    }
+
+    // order[k] is read before tree->parent[k] (the same slot) is overwritten
+    for (int k = 0; k < count; k++) {
+        const Process *proc = &processes[order[k]];
+        int old_parent = parent[order[k]];
+
+        tree->pid[k] = proc->pid;
+        tree->parent[k] = (old_parent >= 0) ? new_index[old_parent] : -1 - proc->ppid;
+        tree->state[k] = proc->state;
+        tree->subtree_size[k] = 1;
+    }
+    free(parent);
+
+    // In pre-order every node precedes its descendants
+    for (int k = count - 1; k >= 0; k--) {
+        if (tree->parent[k] >= 0) {
+            tree->subtree_size[tree->parent[k]] += tree->subtree_size[k];
+        }
+    }
+
+    if (tree->lookup_direct) {
+        for (int k = 0; k < count; k++) {
+            tree->lookup[tree->pid[k]] = k;
+        }
+    } else {
+        for (unsigned int slot = 0; slot < tree->lookup_size; slot++) {
+            if (tree->lookup[slot] != -1) {
+                tree->lookup[slot] = new_index[tree->lookup[slot]];
+            }
+        }
+    }
+
+    if (keep_details) {
+        tree->details = compact_process_details(processes, count, new_index);
+    } else {
+        free(processes);
+    }
+    free(first_child);
+    return 1;
+}
+
+// ------------------------ SNAPSHOT CACHE ------------------------ //
+
+#define SNAPSHOT_CACHE_MAGIC 0x74637270u   // "prct"
+#define SNAPSHOT_CACHE_VERSION 5
+#define SNAPSHOT_CACHE_RETRIES 8
+
+// Header of the shared-memory snapshot cache. The snapshot arrays follow it:
+// details[capacity], pid[capacity], parent[capacity], subtree_size[capacity],
+// state[capacity]. Readers rebuild the PID lookup table themselves.
+typedef struct SnapshotCacheHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long seq;          // Seqlock: odd while a writer is updating
+    unsigned long long generation;   // Number of snapshots published so far
+    long long timestamp_ns;          // CLOCK_MONOTONIC time the scan started
+    int count;
+    int capacity;                    // Processes the segment has room for
+    int has_details;                 // details[] holds valid data
+    int consistency;                 // Consistency level of the cached snapshot
+    int rescanned;
+} SnapshotCacheHeader;
+
+// Arrays that follow the header in a mapped segment
+typedef struct SnapshotCacheArrays {
+    ProcessDetails *details;
+    pid_t *pid;
+    int *parent;
+    int *subtree_size;
+    char *state;
+} SnapshotCacheArrays;
+
+// Function to get the current CLOCK_MONOTONIC time in nanoseconds
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Function to build the per-user name of the cache segment
+void snapshot_cache_name(char *name, size_t size) {
+    snprintf(name, size, "/prct-snapshot-%u", (unsigned int)getuid());
+}
+
+// Function to compute the segment size needed for capacity processes
+size_t snapshot_cache_size(int capacity) {
+    return sizeof(SnapshotCacheHeader) +
+           (size_t)capacity * (sizeof(ProcessDetails) + sizeof(pid_t) + 2 * sizeof(int) + 1);
+}
+
+// Function to locate the arrays that follow the header in a mapped segment
+SnapshotCacheArrays snapshot_cache_arrays(char *base, int capacity) {
+    SnapshotCacheArrays arrays;
+
+    arrays.details = (ProcessDetails *)(base + sizeof(SnapshotCacheHeader));
+    arrays.pid = (pid_t *)(arrays.details + capacity);
+    arrays.parent = (int *)(arrays.pid + capacity);
+    arrays.subtree_size = arrays.parent + capacity;
+    arrays.state = (char *)(arrays.subtree_size + capacity);
+    return arrays;
+}
+
+// Function to load a snapshot no older than opts->cache_ttl_ms from the
+// cache; returns 0 on a miss
+int load_cached_process_tree(const SnapshotOptions *opts, ProcessTree *tree) {
+    char name[64];
+    struct stat st;
+
+    snapshot_cache_name(name, sizeof(name));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || st.st_uid != getuid() ||
+        (size_t)st.st_size < sizeof(SnapshotCacheHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    size_t mapped = st.st_size;
+    char *base = mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+
+    const SnapshotCacheHeader *hdr = (const SnapshotCacheHeader *)base;
+    int loaded = 0;
+    memset(tree, 0, sizeof(*tree));
+
+    for (int attempt = 0; attempt < SNAPSHOT_CACHE_RETRIES && !loaded; attempt++) {
+        unsigned long long seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        int count = hdr->count;
+        int capacity = hdr->capacity;
+        int consistency = hdr->consistency;
+        int rescanned = hdr->rescanned;
+        long long age_ns = monotonic_ns() - hdr->timestamp_ns;
+        if (hdr->magic != SNAPSHOT_CACHE_MAGIC || hdr->version != SNAPSHOT_CACHE_VERSION ||
+            count < 0 || count > capacity || snapshot_cache_size(capacity) > mapped ||
+            (opts->details && !hdr->has_details) ||
+            age_ns < 0 || age_ns / 1000000 > opts->cache_ttl_ms) {
+            // Re-check the sequence so a half-written header is retried, not trusted
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq) {
+                break;
+            }
+            continue;
+        }
+
+        SnapshotCacheArrays arrays = snapshot_cache_arrays(base, capacity);
+
+        if (!tree->pid) {
+            tree->pid = malloc((count + 1) * sizeof(pid_t));
+            tree->parent = malloc((count + 1) * sizeof(int));
+            tree->subtree_size = malloc((count + 1) * sizeof(int));
+            tree->state = malloc(count + 1);
+            if (opts->details) {
+                tree->details = malloc((count + 1) * sizeof(ProcessDetails));
+            }
+            tree->count = count;
+        }
+        if (tree->count != count || !tree->pid || !tree->parent || !tree->subtree_size ||
+            !tree->state || (opts->details && !tree->details)) {
+            free_process_tree(tree);
+            continue;
+        }
+
+        memcpy(tree->pid, arrays.pid, count * sizeof(pid_t));
+        memcpy(tree->parent, arrays.parent, count * sizeof(int));
+        memcpy(tree->subtree_size, arrays.subtree_size, count * sizeof(int));
+        memcpy(tree->state, arrays.state, count);
+        if (tree->details) {
+            memcpy(tree->details, arrays.details, count * sizeof(ProcessDetails));
+        }
+
+        tree->consistency = consistency;
+        tree->rescanned = rescanned;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        loaded = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq;
+    }
+
+    munmap(base, mapped);
+    if (loaded && !build_pid_lookup(tree)) {
+        loaded = 0;
+    }
+    if (!loaded) {
+        free_process_tree(tree);
+    }
+    return loaded;
+}
+
+// Function to publish a snapshot to the cache (skipped if another writer is
+// busy); scan_ns is when the scan started, which is what the TTL is measured from
+void publish_process_tree(const ProcessTree *tree, long long scan_ns) {
+    char name[64];
+    struct stat st;
+
+    snapshot_cache_name(name, sizeof(name));
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0 || st.st_uid != getuid()) {
+        close(fd);
+        return;
+    }
+
+    // Grow (never shrink) the segment, leaving headroom so it is rarely resized
+    int capacity = 0;
+    if ((size_t)st.st_size >= sizeof(SnapshotCacheHeader)) {
+        char *probe = mmap(NULL, sizeof(SnapshotCacheHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (probe != MAP_FAILED) {
+            const SnapshotCacheHeader *old = (const SnapshotCacheHeader *)probe;
+            if (old->magic == SNAPSHOT_CACHE_MAGIC && old->version == SNAPSHOT_CACHE_VERSION &&
+                snapshot_cache_size(old->capacity) <= (size_t)st.st_size) {
+                capacity = old->capacity;
+            }
+            munmap(probe, sizeof(SnapshotCacheHeader));
+        }
+    }
+    if (capacity < tree->count) {
+        capacity = tree->count + tree->count / 4 + 64;
+    }
+
+    size_t size = snapshot_cache_size(capacity);
+    if ((size_t)st.st_size < size && ftruncate(fd, size) < 0) {
+        close(fd);
+        return;
+    }
+    if ((size_t)st.st_size > size) {
+        size = st.st_size;
+    }
+
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    SnapshotCacheHeader *hdr = (SnapshotCacheHeader *)base;
+    unsigned long long seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+    unsigned long long generation = (hdr->magic == SNAPSHOT_CACHE_MAGIC) ? hdr->generation : 0;
+
+    // Seqlock write: odd sequence, data, then the next even sequence
+    __atomic_store_n(&hdr->seq, (seq | 1) + ((seq & 1) ? 2 : 0), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    SnapshotCacheArrays arrays = snapshot_cache_arrays(base, capacity);
+    memcpy(arrays.pid, tree->pid, tree->count * sizeof(pid_t));
+    memcpy(arrays.parent, tree->parent, tree->count * sizeof(int));
+    memcpy(arrays.subtree_size, tree->subtree_size, tree->count * sizeof(int));
+    memcpy(arrays.state, tree->state, tree->count);
+    if (tree->details) {
+        memcpy(arrays.details, tree->details, tree->count * sizeof(ProcessDetails));
+    }
+
+    hdr->magic = SNAPSHOT_CACHE_MAGIC;
+    hdr->version = SNAPSHOT_CACHE_VERSION;
+    hdr->generation = generation + 1;
+    hdr->timestamp_ns = scan_ns;
+    hdr->count = tree->count;
+    hdr->capacity = capacity;
+    hdr->has_details = tree->details != NULL;
+    hdr->consistency = tree->consistency;
+    hdr->rescanned = tree->rescanned;
+
+    __atomic_store_n(&hdr->seq, __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+
+    munmap(base, size);
+    close(fd);
+}
+
+// ------------------------ SNAPSHOT CONSISTENCY ------------------------ //
+
+// Repair rounds after which a scan is given up on even if budget is left
+#define SNAPSHOT_REPAIR_ROUNDS 4
+
+// Time allowed for repairing a scan in milliseconds (PRCT_REPAIR_BUDGET_MS)
+long snapshot_repair_budget_ms = 100;
+
+// Function to find a PID in a scan sorted by PID, or -1 if it is absent
+int find_scanned_process(const Process *processes, int count, pid_t pid) {
+    int lo = 0, hi = count - 1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (processes[mid].pid == pid) {
+            return mid;
+        }
+        if (processes[mid].pid < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+// Function to check the parent link of processes[i]. PPID 0 means the parent
+// is outside this PID namespace (or i is a kernel root), which is fine.
+int parent_link_holds(const Process *processes, int count, int i) {
+    const Process *proc = &processes[i];
+
+    if (proc->ppid == 0) {
+        return 1;
+    }
+    int p = find_scanned_process(processes, count, proc->ppid);
+    return p >= 0 && p != i && processes[p].start_ticks <= proc->start_ticks;
+}
+
+// Function to re-read one PID into a sorted scan: the entry is refreshed,
+// replaced if the PID was reused, dropped if the process exited, or
+// inserted if the scan missed it. *changed is set when its parent link or
+// identity differs from what the scan had. Returns 1 if the process exists.
+int rescan_process(Process **processes, int *count, pid_t pid, int *changed) {
+    Process fresh;
+    int i = find_scanned_process(*processes, *count, pid);
+    int exists = get_process_info(pid, &fresh);
+
+    if (exists && i >= 0) {
+        const Process *old = &(*processes)[i];
+        if (old->ppid != fresh.ppid || old->start_ticks != fresh.start_ticks) {
+            *changed = 1;
+        }
+        (*processes)[i] = fresh;
+    } else if (i >= 0) {
+        memmove(&(*processes)[i], &(*processes)[i + 1], (*count - i - 1) * sizeof(Process));
+        (*count)--;
+        *changed = 1;
+    } else if (exists) {
+        Process *grown = realloc(*processes, (*count + 1) * sizeof(Process));
+        if (!grown) {
+            return 1;
+        }
+        *processes = grown;
+        for (i = *count; i > 0 && (*processes)[i - 1].pid > pid; i--) {
+            (*processes)[i] = (*processes)[i - 1];
+        }
+        (*processes)[i] = fresh;
+        (*count)++;
+        *changed = 1;
+    }
+    return exists;
+}
+
+// Function to add a PID to a sorted list (no-op if it is already there)
+void insert_sorted_pid(pid_t **pids, int *count, pid_t pid) {
+    if (*count > 0 && bsearch(&pid, *pids, *count, sizeof(pid_t), compare_pid)) {
+        return;
+    }
+    pid_t *grown = realloc(*pids, (*count + 1) * sizeof(pid_t));
+    if (!grown) {
+        return;
+    }
+    *pids = grown;
+
+    int i = *count;
+    for (; i > 0 && (*pids)[i - 1] > pid; i--) {
+        (*pids)[i] = (*pids)[i - 1];
+    }
+    (*pids)[i] = pid;
+    (*count)++;
+}
+
+// Function to make a scan consistent: every process whose parent is missing
+// or started after it is re-read together with its (possibly new) parent,
+// for up to SNAPSHOT_REPAIR_ROUNDS rounds within budget_ms. Only the broken
+// fragments are read again, never the whole of /proc. Returns the level;
+// re-reads that find nothing changed leave the scan "consistent".
+int repair_process_scan(Process **processes, int *count, long budget_ms, int *rescanned) {
+    long long deadline_ns = monotonic_ns() + budget_ms * 1000000LL;
+    int changed = 0;
+    // Children that, re-read, still name the same parent and that parent is
+    // still not in /proc (e.g. hidden by hidepid). The kernel reparents before
+    // a PID disappears, so these links are genuine; kept sorted for bsearch
+    pid_t *settled = NULL;
+    int settled_count = 0;
+
+    *rescanned = 0;
+    sort_processes_by_pid(*processes, *count);
+
+    for (int round = 0; ; round++) {
+        pid_t *broken = NULL;
+        int n = 0;
+
+        for (int i = 0; i < *count; i++) {
+            const Process *proc = &(*processes)[i];
+            if (parent_link_holds(*processes, *count, i) ||
+                (settled_count > 0 &&
+                 bsearch(&proc->pid, settled, settled_count, sizeof(pid_t), compare_pid))) {
+                continue;
+            }
+            if (n % 64 == 0) {
+                pid_t *grown = realloc(broken, (n + 64) * sizeof(pid_t));
+                if (!grown) {
+                    break;
+                }
+                broken = grown;
+            }
+            broken[n++] = proc->pid;
+        }
+
+        if (n == 0 || round == SNAPSHOT_REPAIR_ROUNDS || monotonic_ns() >= deadline_ns) {
+            free(broken);
+            free(settled);
+            if (n > 0) {
+                return SNAPSHOT_INCONSISTENT;
+            }
+            return changed ? SNAPSHOT_REPAIRED : SNAPSHOT_CONSISTENT;
+        }
+
+        for (int k = 0; k < n && monotonic_ns() < deadline_ns; k++) {
+            int i = find_scanned_process(*processes, *count, broken[k]);
+            pid_t old_ppid = (i >= 0) ? (*processes)[i].ppid : 0;
+
+            (*rescanned)++;
+            if (!rescan_process(processes, count, broken[k], &changed)) {
+                continue;
+            }
+
+            // A child whose parent exited has been reparented by now; re-read
+            // whichever parent it reports if that entry does not fit either
+            i = find_scanned_process(*processes, *count, broken[k]);
+            if (i < 0 || parent_link_holds(*processes, *count, i)) {
+                continue;
+            }
+            pid_t ppid = (*processes)[i].ppid;
+            (*rescanned)++;
+            if (!rescan_process(processes, count, ppid, &changed) && ppid == old_ppid) {
+                insert_sorted_pid(&settled, &settled_count, broken[k]);
+            }
+        }
+        free(broken);
+    }
+}
+
+// Function to take an indexed snapshot of all processes, reusing the shared
+// cache when it is enabled and fresh
+int snapshot_process_tree(const SnapshotOptions *opts, ProcessTree *tree) {
+    Process *processes;
+    int count;
+    int rescanned;
+
+    if (opts->cache_ttl_ms > 0 && load_cached_process_tree(opts, tree)) {
+        return 1;
+    }
+
+    long long scan_ns = monotonic_ns();
+    get_all_processes(&processes, &count);
+    int consistency = repair_process_scan(&processes, &count, snapshot_repair_budget_ms,
+                                          &rescanned);
+    if (!build_process_tree(processes, count, opts->details, tree)) {
+        return 0;
+    }
+    tree->consistency = consistency;
+    tree->rescanned = rescanned;
+    if (consistency == SNAPSHOT_INCONSISTENT) {
+        fprintf(stderr, "Warning: the process table changed faster than it could be re-read; "
+                        "processes with unverified parents are treated as roots\n");
+    }
+
+    if (opts->cache_ttl_ms > 0) {
+        publish_process_tree(tree, scan_ns);
+    }
+    return 1;
+}
+
+// Snapshot being sorted by compare_render_order (qsort has no context argument)
+const ProcessTree *render_sort_tree;
+
+// Function to order siblings so identical leaves end up next to each other
+int compare_render_order(const void *a, const void *b) {
+    const ProcessTree *tree = render_sort_tree;
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+
+    int cmp = strcmp(tree_comm(tree, ia), tree_comm(tree, ib));
+    if (cmp != 0) {
+        return cmp;
+    }
+    int leaf_a = tree->subtree_size[ia] == 1;
+    int leaf_b = tree->subtree_size[ib] == 1;
+    if (leaf_a != leaf_b) {
+        return leaf_a - leaf_b;
+    }
+    if (tree->state[ia] != tree->state[ib]) {
+        return tree->state[ia] - tree->state[ib];
+    }
+    if (tree->details && tree->details[ia].threads != tree->details[ib].threads) {
+        return tree->details[ia].threads - tree->details[ib].threads;
+    }
+    return (tree->pid[ia] > tree->pid[ib]) - (tree->pid[ia] < tree->pid[ib]);
+}
+
+// Function to get the thread count shown for a node, or 0 if it is not shown
+int shown_threads(const ProcessTree *tree, int node, const TreeRenderOptions *opts) {
+    return (opts->show_threads && tree->details) ? tree->details[node].threads : 0;
+}
+
+// Function to check if two siblings can be collapsed into one "N*[comm]" line
+int same_leaf_group(const ProcessTree *tree, int a, int b, const TreeRenderOptions *opts) {
+    return tree->subtree_size[a] == 1 && tree->subtree_size[b] == 1 &&
+           tree->state[a] == tree->state[b] &&
+           shown_threads(tree, a, opts) == shown_threads(tree, b, opts) &&
+           strcmp(tree_comm(tree, a), tree_comm(tree, b)) == 0;
+}
+
+// Function to print the zombie/stopped marker for a process state
+void print_state_marker(char state, FILE *out) {
+    if (state == 'Z') {
+        fputs(" <defunct>", out);
+    } else if (state == 'T' || state == 't') {
+        fputs(" <stopped>", out);
+    }
+}
+
+// Function to print a single node label of the rendered tree
+void print_tree_node(const ProcessTree *tree, int node, const TreeRenderOptions *opts,
+                     int truncated, FILE *out) {
+    fprintf(out, "%s(%d)", tree_comm(tree, node), tree->pid[node]);
+    if (shown_threads(tree, node, opts)) {
+        fprintf(out, " {%d}", shown_threads(tree, node, opts));
+    }
+    print_state_marker(tree->state[node], out);
+    if (opts->show_counts && tree->subtree_size[node] > 1) {
+        fprintf(out, " [%d]", tree->subtree_size[node] - 1);
+    }
+    if (truncated) {
+        fputs(" ...", out);
+    }
+    fputc('\n', out);
+}
+
+// Frame of the iterative depth-first walk in render_process_tree
+typedef struct RenderFrame {
+    const int *children;
+    int pos;
+    int n;
+} RenderFrame;
+
+// Function to set up the frame listing the children of a node. The list is
+// pushed onto the siblings[] stack and, in compact mode, ordered for grouping.
+void init_render_frame(const ProcessTree *tree, int node, const TreeRenderOptions *opts,
+                       int *siblings, int *siblings_top, RenderFrame *frame) {
+    int *children = &siblings[*siblings_top];
+    int n = 0;
+
+    for (int c = node + 1; c < node + tree->subtree_size[node]; c += tree->subtree_size[c]) {
+        children[n++] = c;
+    }
+    *siblings_top += n;
+
+    if (opts->compact) {
+        render_sort_tree = tree;
+        qsort(children, n, sizeof(int), compare_render_order);
+    }
+
+    frame->children = children;
+    frame->pos = 0;
+    frame->n = n;
+}
+
+// Function to draw the subtree rooted at node in pstree style.
+// The walk is iterative, so deep chains cannot overflow the stack; output is
+// streamed and the only extra memory is the current path and its sibling lists.
+void render_process_tree(const ProcessTree *tree, int node, const TreeRenderOptions *opts,
+                         FILE *out) {
+    if (node < 0 || node >= tree->count) {
+        return;
+    }
+
+    int has_children = tree->subtree_size[node] > 1;
+    int expand = has_children && opts->max_depth != 0;
+    print_tree_node(tree, node, opts, has_children && !expand, out);
+    if (!expand) {
+        return;
+    }
+
+    int frame_cap = 64;
+    int prefix_cap = 256;
+    RenderFrame *frames = malloc(frame_cap * sizeof(RenderFrame));
+    char *prefix = malloc(prefix_cap);
+    int *siblings = malloc(tree->subtree_size[node] * sizeof(int));
+    if (!frames || !prefix || !siblings) {
+        perror("Failed to render process tree");
+        free(frames);
+        free(prefix);
+        free(siblings);
+        return;
+    }
+
+    int depth = 0;         // Number of frames on the stack
+    int prefix_len = 0;
+    int siblings_top = 0;  // Sibling lists of the current path are stacked in siblings[]
+    prefix[0] = '\0';
+
+    init_render_frame(tree, node, opts, siblings, &siblings_top, &frames[depth++]);
+
+    while (depth > 0) {
+        RenderFrame *frame = &frames[depth - 1];
+
+        if (frame->pos >= frame->n) {
+            siblings_top -= frame->n;
+            depth--;
+            if (depth > 0) {
+                prefix_len -= 4;
+                prefix[prefix_len] = '\0';
+            }
+            continue;
+        }
+
+        int child = frame->children[frame->pos];
+        int run = 1;
+        if (opts->compact) {
+            while (frame->pos + run < frame->n &&
+                   same_leaf_group(tree, child, frame->children[frame->pos + run], opts)) {
+                run++;
+            }
+        }
+        frame->pos += run;
+        int last = frame->pos >= frame->n;
+
+        fputs(prefix, out);
+        fputs(last ? "`-- " : "|-- ", out);
+
+        if (run > 1) {
+            // Every process in the group has the same thread count
+            if (shown_threads(tree, child, opts)) {
+                fprintf(out, "%d*[%s {%d}]", run, tree_comm(tree, child),
+                        shown_threads(tree, child, opts));
+            } else {
+                fprintf(out, "%d*[%s]", run, tree_comm(tree, child));
+            }
+            print_state_marker(tree->state[child], out);
+            fputc('\n', out);
+            continue;
+        }
+
+        has_children = tree->subtree_size[child] > 1;
+        expand = has_children && (opts->max_depth < 0 || depth < opts->max_depth);
+        print_tree_node(tree, child, opts, has_children && !expand, out);
+        if (!expand) {
+            continue;
+        }
+
+        if (depth == frame_cap) {
+            frame_cap *= 2;
+            RenderFrame *grown = realloc(frames, frame_cap * sizeof(RenderFrame));
+            if (!grown) {
+                perror("Failed to render process tree");
+                break;
+            }
+            frames = grown;
+        }
+        if (prefix_len + 5 > prefix_cap) {
+            prefix_cap *= 2;
+            char *grown = realloc(prefix, prefix_cap);
+            if (!grown) {
+                perror("Failed to render process tree");
+                break;
+            }
+            prefix = grown;
+        }
+        memcpy(&prefix[prefix_len], last ? "    " : "|   ", 5);
+        prefix_len += 4;
+
+        init_render_frame(tree, child, opts, siblings, &siblings_top, &frames[depth++]);
+    }
+
+    free(frames);
+    free(prefix);
+    free(siblings);
+}
+
+// ------------------------ SUBTREE REDUCTIONS ------------------------ //
+
+// Shared state of one parallel reduction
+typedef struct ReductionJob {
+    const ProcessTree *tree;
+    const TreeReduction *red;
+    int first;            // Index range being reduced, [first, last)
+    int last;
+    int chunk;            // Nodes per task
+    int task_count;
+    char *values;         // One partial value per task, task_count * value_size
+    int next_task;        // Next unclaimed task (atomic)
+} ReductionJob;
+
+// Ranges smaller than this are never split off as separate tasks
+#define REDUCE_MIN_CUTOFF 4096
+
+// Function to pick the worker count (PRCT_THREADS overrides the core count)
+int reduction_threads() {
+    const char *env = getenv("PRCT_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+
+    // sysconf reads /sys on every call, so look the core count up once
+    static int cores = 0;
+    if (cores == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        cores = online > 0 ? (int)online : 1;
+    }
+    return cores;
+}
+
+// Function to fold the nodes in [first, last) into value on the calling thread.
+// Subtrees are contiguous in pre-order, so this is a plain linear scan.
+void reduce_range_sequential(const ProcessTree *tree, int first, int last,
+                             const TreeReduction *red, void *value) {
+    for (int i = first; i < last; i++) {
+        red->map(tree, i, value, red->ctx);
+    }
+}
+
+// Worker loop: claim tasks until none are left
+void *reduction_worker(void *arg) {
+    ReductionJob *job = arg;
+    int task;
+
+    while ((task = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED)) < job->task_count) {
+        int first = job->first + task * job->chunk;
+        int last = first + job->chunk < job->last ? first + job->chunk : job->last;
+        reduce_range_sequential(job->tree, first, last, job->red,
+                                job->values + (size_t)task * job->red->value_size);
+    }
+
+    return NULL;
+}
+
+// Function to reduce the subtree of node (optionally without node itself) into value.
+// The subtree occupies one index range, which large reductions cut into equal
+// chunks that a pool of threads claims dynamically; partial values are combined
+// in chunk order.
+void parallel_reduce(const ProcessTree *tree, int node, int include_root,
+                     const TreeReduction *red, int threads, void *value) {
+    red->init(value, red->ctx);
+    if (node < 0 || node >= tree->count) {
+        return;
+    }
+
+    int first = include_root ? node : node + 1;
+    int last = node + tree->subtree_size[node];
+    int size = last - first;
+    if (threads <= 1 || size < 2 * REDUCE_MIN_CUTOFF) {
+        reduce_range_sequential(tree, first, last, red, value);
+        return;
+    }
+
+    // Aim for several tasks per thread so a slow map on one region still balances out
+    int chunk = size / (threads * 8);
+    if (chunk < REDUCE_MIN_CUTOFF) {
+        chunk = REDUCE_MIN_CUTOFF;
+    }
+
+    ReductionJob job = { tree, red, first, last, chunk, (size + chunk - 1) / chunk, NULL, 0 };
+    job.values = malloc((size_t)job.task_count * red->value_size);
+    if (!job.values) {
+        perror("Failed to reduce subtree");
+        return;
+    }
+    for (int i = 0; i < job.task_count; i++) {
+        red->init(job.values + (size_t)i * red->value_size, red->ctx);
+    }
+
+    if (threads > job.task_count) {
+        threads = job.task_count;
+    }
+    pthread_t *workers = malloc((threads + 1) * sizeof(pthread_t));
+    int started = 0;
+    while (workers && started < threads - 1 &&
+           pthread_create(&workers[started], NULL, reduction_worker, &job) == 0) {
+        started++;
+    }
+    reduction_worker(&job);
+
+    // Join, then combine in task order
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (int i = 0; i < job.task_count; i++) {
+        red->combine(value, job.values + (size_t)i * red->value_size, red->ctx);
+    }
+
+    free(workers);
+    free(job.values);
+}
+
+// Function to check if a process matches a selector
+int selector_matches(const ProcessTree *tree, int node, const ProcessSelector *sel) {
+    if (sel->state && tree->state[node] != sel->state) {
+        return 0;
+    }
+    return sel->exclude_parent < 0 || tree->parent[node] != sel->exclude_parent;
+}
+
+void count_init(void *value, void *ctx) {
+    *(long *)value = 0;
+}
+
+void count_map(const ProcessTree *tree, int node, void *value, void *ctx) {
+    if (selector_matches(tree, node, ctx)) {
+        (*(long *)value)++;
+    }
+}
+
+void count_combine(void *value, void *other, void *ctx) {
+    *(long *)value += *(long *)other;
+}
+
+// Growable PID list used as the value of list reductions
+typedef struct PidList {
+    pid_t *pids;
+    int count;
+    int capacity;
+} PidList;
+
+void list_init(void *value, void *ctx) {
+    memset(value, 0, sizeof(PidList));
+}
+
+void list_map(const ProcessTree *tree, int node, void *value, void *ctx) {
+    PidList *list = value;
+
+    if (!selector_matches(tree, node, ctx)) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        pid_t *grown = realloc(list->pids, capacity * sizeof(pid_t));
+        if (!grown) {
+            return;
+        }
+        list->pids = grown;
+        list->capacity = capacity;
+    }
+    list->pids[list->count++] = tree->pid[node];
+}
+
+void list_combine(void *value, void *other, void *ctx) {
+    PidList *list = value;
+    PidList *part = other;
+
+    if (list->count + part->count > list->capacity) {
+        int capacity = list->count + part->count;
+        pid_t *grown = realloc(list->pids, capacity * sizeof(pid_t));
+        if (!grown) {
+            free(part->pids);
+            return;
+        }
+        list->pids = grown;
+        list->capacity = capacity;
+    }
+    if (part->count > 0) {
+        memcpy(&list->pids[list->count], part->pids, part->count * sizeof(pid_t));
+    }
+    list->count += part->count;
+    free(part->pids);
+}
+
+void aggregate_init(void *value, void *ctx) {
+    memset(value, 0, sizeof(TreeAggregate));
+}
+
+void aggregate_map(const ProcessTree *tree, int node, void *value, void *ctx) {
+    TreeAggregate *agg = value;
+
+    agg->processes++;
+    switch (tree->state[node]) {
+        case 'R': agg->running++; break;
+        case 'S': agg->sleeping++; break;
+        case 'D': agg->disk_sleep++; break;
+        case 'T':
+        case 't': agg->stopped++; break;
+        case 'Z': agg->zombies++; break;
+    }
+    if (tree->details) {
+        const ProcessDetails *det = &tree->details[node];
+        agg->threads += det->threads;
+        agg->cpu_ticks += det->cpu_ticks;
+        agg->rss_pages += det->rss_pages;
+    }
+}
+
+void aggregate_combine(void *value, void *other, void *ctx) {
+    TreeAggregate *agg = value;
+    const TreeAggregate *part = other;
+
+    agg->processes += part->processes;
+    agg->running += part->running;
+    agg->sleeping += part->sleeping;
+    agg->disk_sleep += part->disk_sleep;
+    agg->stopped += part->stopped;
+    agg->zombies += part->zombies;
+    agg->threads += part->threads;
+    agg->cpu_ticks += part->cpu_ticks;
+    agg->rss_pages += part->rss_pages;
+}
+
+// Function to count the descendants of node that match a selector
+long count_descendants(const ProcessTree *tree, int node, ProcessSelector sel) {
+    TreeReduction red = { sizeof(long), count_init, count_map, count_combine, &sel };
+    long count;
+
+    parallel_reduce(tree, node, 0, &red, reduction_threads(), &count);
+    return count;
+}
+
+// Function to list the descendants of node that match a selector, in PID order
+void list_descendants(const ProcessTree *tree, int node, ProcessSelector sel,
+                      pid_t **pids, int *count) {
+    TreeReduction red = { sizeof(PidList), list_init, list_map, list_combine, &sel };
+    PidList list;
+
+    parallel_reduce(tree, node, 0, &red, reduction_threads(), &list);
+    // The snapshot is in tree order, so sort to report descendants by PID
+    if (list.count > 1) {
+        qsort(list.pids, list.count, sizeof(pid_t), compare_pid);
+    }
+    *pids = list.pids;
+    *count = list.count;
+}
+
+// Function to total states and resources over the subtree of node (including node)
+void aggregate_subtree(const ProcessTree *tree, int node, int threads, TreeAggregate *agg) {
+    TreeReduction red = { sizeof(TreeAggregate), aggregate_init, aggregate_map,
+                          aggregate_combine, NULL };
+
+    parallel_reduce(tree, node, 1, &red, threads, agg);
+}
+
+// Function to generate a random synthetic tree of count processes (PID 1 is the root)
+int generate_synthetic_tree(int count, unsigned int seed, ProcessTree *tree) {
+    static const char *names[] = { "worker", "sh", "python3", "sleep", "nginx", "java" };
+    Process *processes = malloc((count > 0 ? count : 1) * sizeof(Process));
+
+    if (!processes) {
+        perror("Failed to generate synthetic tree");
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        Process *proc = &processes[i];
+        seed = seed * 1103515245u + 12345u;
+
+        memset(proc, 0, sizeof(*proc));
+        proc->pid = i + 1;
+        proc->ppid = (i == 0) ? 0 : 1 + (int)((seed >> 8) % (unsigned int)i);
+        proc->state = (seed % 97 == 0) ? 'Z' : (seed % 89 == 0) ? 'T' : 'S';
+        snprintf(proc->comm, sizeof(proc->comm), "%s", names[(seed >> 4) % 6]);
+        proc->cpu_ticks = (seed >> 12) % 1000;
+        proc->rss_pages = (proc->state == 'Z') ? 0 : (long)((seed >> 16) % 4096);
+        proc->threads = (proc->state == 'Z') ? 1 : 1 + (int)((seed >> 20) % 8);
+        proc->start_ticks = (unsigned long long)i * 10;
+    }
+
+    return build_process_tree(processes, count, 1, tree);
+}
+
+// Function to time aggregate reductions for 1..N threads and report the speedup
+void report_reduction_speedup(const ProcessTree *tree, int node) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = reduction_threads();
+    TreeAggregate expected;
+    double baseline = 0;
+
+    aggregate_subtree(tree, node, 1, &expected);
+    printf("Reducing %ld processes on %ld core(s), up to %d thread(s)\n",
+           expected.processes, cores, max_threads);
+    printf("%8s %12s %8s %6s\n", "threads", "median_ms", "speedup", "match");
+
+    for (int threads = 1; ; threads = (threads * 2 > max_threads) ? max_threads : threads * 2) {
+        double samples[5];
+
+        int match = 1;
+        for (int run = 0; run < 5; run++) {
+            TreeAggregate agg;
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            aggregate_subtree(tree, node, threads, &agg);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            samples[run] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+            match &= memcmp(&agg, &expected, sizeof(agg)) == 0;
+        }
+        qsort(samples, 5, sizeof(double), compare_double);
+        if (threads == 1) {
+            baseline = samples[2];
+        }
+        printf("%8d %12.3f %7.2fx %6s\n", threads, samples[2],
+               samples[2] > 0 ? baseline / samples[2] : 0.0, match ? "yes" : "NO");
+
+        if (threads >= max_threads) {
+            break;
+        }
+    }
+}
+
+// ------------------------ THREAD ANALYSIS ------------------------ //
+
+// Thread counts by state over a set of processes
+typedef struct ThreadHistogram {
+    long processes;
+    long threads;
+    long running;
+    long sleeping;
+    long disk_sleep;
+    long stopped;
+    long zombies;
+    long other;
+} ThreadHistogram;
+
+// Growable list of thread records (pid = TID, ppid = owning process)
+typedef struct ThreadList {
+    Process *threads;
+    int count;
+    int capacity;
+} ThreadList;
+
+// Function to read the threads of a process from /proc/<pid>/task. Each
+// record's pid is the TID and its ppid is the owning process.
+int get_process_threads(pid_t pid, Process **threads, int *count) {
+    char path[256];
+    DIR *dir;
+    struct dirent *entry;
+    int capacity = 0;
+
+    *threads = NULL;
+    *count = 0;
+
+    sprintf(path, "/proc/%d/task", pid);
+    dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+
+    while ((entry = readdir(dir))) {
+        if (!isdigit(entry->d_name[0])) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            Process *grown = realloc(*threads, capacity * sizeof(Process));
+            if (!grown) {
+                break;
+            }
+            *threads = grown;
+        }
+
+        Process *thread = &(*threads)[*count];
+        thread->pid = atoi(entry->d_name);
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, thread->pid);
+        if (read_stat_file(path, thread)) {
+            thread->ppid = pid;
+            (*count)++;
+        }
+    }
+
+    closedir(dir);
+    return 1;
+}
+
+void thread_histogram_init(void *value, void *ctx) {
+    memset(value, 0, sizeof(ThreadHistogram));
+}
+
+// Tasks are only enumerated here, i.e. for processes inside the reduced subtree
+void thread_histogram_map(const ProcessTree *tree, int node, void *value, void *ctx) {
+    ThreadHistogram *hist = value;
+    Process *threads;
+    int count;
+
+    hist->processes++;
+    if (!get_process_threads(tree->pid[node], &threads, &count)) {
+        return;
+    }
+
+    hist->threads += count;
+    for (int i = 0; i < count; i++) {
+        switch (threads[i].state) {
+            case 'R': hist->running++; break;
+            case 'S': hist->sleeping++; break;
+            case 'D': hist->disk_sleep++; break;
+            case 'T':
+            case 't': hist->stopped++; break;
+            case 'Z': hist->zombies++; break;
+            default: hist->other++; break;
+        }
+    }
+    free(threads);
+}
+
+void thread_histogram_combine(void *value, void *other, void *ctx) {
+    ThreadHistogram *hist = value;
+    const ThreadHistogram *part = other;
+
+    hist->processes += part->processes;
+    hist->threads += part->threads;
+    hist->running += part->running;
+    hist->sleeping += part->sleeping;
+    hist->disk_sleep += part->disk_sleep;
+    hist->stopped += part->stopped;
+    hist->zombies += part->zombies;
+    hist->other += part->other;
+}
+
+void thread_list_init(void *value, void *ctx) {
+    memset(value, 0, sizeof(ThreadList));
+}
+
+// Keeps the threads whose state is one of the characters in ctx
+void thread_list_map(const ProcessTree *tree, int node, void *value, void *ctx) {
+    ThreadList *list = value;
+    const char *states = ctx;
+    Process *threads;
+    int count;
+
+    if (!get_process_threads(tree->pid[node], &threads, &count)) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!strchr(states, threads[i].state)) {
+            continue;
+        }
+        if (list->count == list->capacity) {
+            int capacity = list->capacity ? list->capacity * 2 : 16;
+            Process *grown = realloc(list->threads, capacity * sizeof(Process));
+            if (!grown) {
+                break;
+            }
+            list->threads = grown;
+            list->capacity = capacity;
+        }
+        list->threads[list->count++] = threads[i];
+    }
+    free(threads);
+}
+
+void thread_list_combine(void *value, void *other, void *ctx) {
+    ThreadList *list = value;
+    ThreadList *part = other;
+
+    if (list->count + part->count > list->capacity) {
+        int capacity = list->count + part->count;
+        Process *grown = realloc(list->threads, capacity * sizeof(Process));
+        if (!grown) {
+            free(part->threads);
+            return;
+        }
+        list->threads = grown;
+        list->capacity = capacity;
+    }
+    if (part->count > 0) {
+        memcpy(&list->threads[list->count], part->threads, part->count * sizeof(Process));
+    }
+    list->count += part->count;
+    free(part->threads);
+}
+
+// Function to compare thread records by owning process, then TID (for qsort)
+int compare_thread_record(const void *a, const void *b) {
+    const Process *ta = a;
+    const Process *tb = b;
+
+    if (ta->ppid != tb->ppid) {
+        return (ta->ppid > tb->ppid) - (ta->ppid < tb->ppid);
+    }
+    return (ta->pid > tb->pid) - (ta->pid < tb->pid);
+}
+
+// Function to print one row of the thread state report
+void print_thread_histogram_row(pid_t pid, const char *comm, const ThreadHistogram *hist) {
+    printf("%8d %6ld %8ld %6ld %6ld %6ld %6ld %6ld %6ld  %s\n", pid, hist->processes,
+           hist->threads, hist->running, hist->sleeping, hist->disk_sleep, hist->stopped,
+           hist->zombies, hist->other, comm);
+}
+
+// Function to report thread states for node itself and for each child's subtree
+void report_thread_states(const ProcessTree *tree, int node) {
+    TreeReduction red = { sizeof(ThreadHistogram), thread_histogram_init, thread_histogram_map,
+                          thread_histogram_combine, NULL };
+    ThreadHistogram total, part;
+
+    printf("%8s %6s %8s %6s %6s %6s %6s %6s %6s  %s\n", "pid", "procs", "threads",
+           "R", "S", "D", "T", "Z", "other", "comm");
+
+    thread_histogram_init(&total, NULL);
+    thread_histogram_map(tree, node, &total, NULL);
+    print_thread_histogram_row(tree->pid[node], tree_comm(tree, node), &total);
+
+    for (int child = node + 1; child < node + tree->subtree_size[node];
+         child += tree->subtree_size[child]) {
+        parallel_reduce(tree, child, 1, &red, reduction_threads(), &part);
+        print_thread_histogram_row(tree->pid[child], tree_comm(tree, child), &part);
+        thread_histogram_combine(&total, &part, NULL);
+    }
+
+    print_thread_histogram_row(tree->pid[node], "(total)", &total);
+}
+
+// Function to list threads in one of the given states within the subtree of
+// node (including node), ordered by process and TID
+void list_subtree_threads(const ProcessTree *tree, int node, const char *states,
+                          Process **threads, int *count) {
+    TreeReduction red = { sizeof(ThreadList), thread_list_init, thread_list_map,
+                          thread_list_combine, (void *)states };
+    ThreadList list;
+
+    parallel_reduce(tree, node, 1, &red, reduction_threads(), &list);
+    if (list.count > 1) {
+        qsort(list.threads, list.count, sizeof(Process), compare_thread_record);
+    }
+    *threads = list.threads;
+    *count = list.count;
+}
+
+// Function to get the descendants of a process
+void get_descendants(const SnapshotOptions *snapshot, pid_t root, pid_t **descendants, int *count) {
+    ProcessTree tree;
+    ProcessSelector all = { 0, -1 };
+
+    *count = 0;
+    *descendants = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+    list_descendants(&tree, find_process_index(&tree, root), all, descendants, count);
+    free_process_tree(&tree);
+}
+
+// Function to list the children of node, in PID order
+void list_children(const ProcessTree *tree, int node, pid_t **children, int *count) {
+    *count = 0;
+    *children = NULL;
+
+    if (node < 0 || node >= tree->count) {
+        return;
+    }
+
+    int end = node + tree->subtree_size[node];
+    int n = 0;
+    for (int c = node + 1; c < end; c += tree->subtree_size[c]) {
+        n++;
+    }
+
+    *children = malloc((n > 0 ? n : 1) * sizeof(pid_t));
+    for (int c = node + 1; *children && c < end; c += tree->subtree_size[c]) {
+        (*children)[(*count)++] = tree->pid[c];
+    }
+}
+
+// Function to get the immediate descendants (children) of a process
+void get_immediate_descendants(const SnapshotOptions *snapshot, pid_t parent, pid_t **children,
+                               int *count) {
+    ProcessTree tree;
+
+    *count = 0;
+    *children = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+    list_children(&tree, find_process_index(&tree, parent), children, count);
+    free_process_tree(&tree);
+}
+
+// Function to get non-direct descendants (not immediate children)
+void get_non_direct_descendants(const SnapshotOptions *snapshot, pid_t root, pid_t **descendants,
+                                int *count) {
+    ProcessTree tree;
+
+    *count = 0;
+    *descendants = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+
+    int node = find_process_index(&tree, root);
+    ProcessSelector non_direct = { 0, node };
+    list_descendants(&tree, node, non_direct, descendants, count);
+    free_process_tree(&tree);
+}
+
+// Function to get defunct descendants
+void get_defunct_descendants(const SnapshotOptions *snapshot, pid_t root, pid_t **defunct,
+                             int *count) {
+    ProcessTree tree;
+    ProcessSelector zombies = { 'Z', -1 };
+
+    *count = 0;
+    *defunct = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+    list_descendants(&tree, find_process_index(&tree, root), zombies, defunct, count);
+    free_process_tree(&tree);
+}
+
+// Function to count defunct descendants
+int count_defunct_descendants(const SnapshotOptions *snapshot, pid_t root) {
+    ProcessTree tree;
+    ProcessSelector zombies = { 'Z', -1 };
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return 0;
+    }
+    long count = count_descendants(&tree, find_process_index(&tree, root), zombies);
+    free_process_tree(&tree);
+    return (int)count;
+}
+
+// Function to list the grandchildren of node, grouped by child
+void list_grandchildren(const ProcessTree *tree, int node, pid_t **grandchildren, int *count) {
+    *count = 0;
+    *grandchildren = NULL;
+
+    if (node < 0 || node >= tree->count) {
+        return;
+    }
+
+    // Count the grandchildren first so the result is allocated once
+    int end = node + tree->subtree_size[node];
+    int n = 0;
+    for (int c = node + 1; c < end; c += tree->subtree_size[c]) {
+        for (int g = c + 1; g < c + tree->subtree_size[c]; g += tree->subtree_size[g]) {
+            n++;
+        }
+    }
+
+    *grandchildren = malloc((n > 0 ? n : 1) * sizeof(pid_t));
+    for (int c = node + 1; *grandchildren && c < end; c += tree->subtree_size[c]) {
+        for (int g = c + 1; g < c + tree->subtree_size[c]; g += tree->subtree_size[g]) {
+            (*grandchildren)[(*count)++] = tree->pid[g];
+        }
+    }
+}
+
+// Function to get the grandchildren of a process
+void get_grandchildren(const SnapshotOptions *snapshot, pid_t root, pid_t **grandchildren,
+                       int *count) {
+    ProcessTree tree;
+
+    *count = 0;
+    *grandchildren = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+    list_grandchildren(&tree, find_process_index(&tree, root), grandchildren, count);
+    free_process_tree(&tree);
+}
+
+// Function to list the siblings of node (optionally only those in a given state)
+void list_siblings(const ProcessTree *tree, int node, char state, pid_t **siblings, int *count) {
+    *count = 0;
+    *siblings = NULL;
+
+    if (node < 0 || node >= tree->count) {
+        return;
+    }
+
+    int parent = tree->parent[node];
+    // Processes whose parent is outside the snapshot (e.g. PPID 0) are roots,
+    // which follow each other in the same way children do; of those, only
+    // the ones with the same PPID are siblings
+    int first = (parent >= 0) ? parent + 1 : 0;
+    int last = (parent >= 0) ? parent + tree->subtree_size[parent] : tree->count;
+    int n = 0;
+    for (int i = first; i < last; i += tree->subtree_size[i]) {
+        n++;
+    }
+
+    *siblings = malloc((n > 0 ? n : 1) * sizeof(pid_t));
+    for (int i = first; *siblings && i < last; i += tree->subtree_size[i]) {
+        if (i == node || tree->parent[i] != parent) {
+            continue;
+        }
+        if (!state || tree->state[i] == state) {
+            (*siblings)[(*count)++] = tree->pid[i];
+        }
+    }
+}
+
+// Function to get siblings of a process (optionally only those in a given state)
+void get_siblings_in_state(const SnapshotOptions *snapshot, pid_t process_id, char state,
+                           pid_t **siblings, int *count) {
+    ProcessTree tree;
+
+    *count = 0;
+    *siblings = NULL;
+
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
+    list_siblings(&tree, find_process_index(&tree, process_id), state, siblings, count);
+    free_process_tree(&tree);
+}
+
+// Function to get siblings of a process
+void get_siblings(const SnapshotOptions *snapshot, pid_t process_id, pid_t **siblings, int *count) {
+    get_siblings_in_state(snapshot, process_id, 0, siblings, count);
+}
+
+// Function to get defunct siblings
+void get_defunct_siblings(const SnapshotOptions *snapshot, pid_t process_id,
+                          pid_t **defunct_siblings, int *count) {
+    get_siblings_in_state(snapshot, process_id, 'Z', defunct_siblings, count);
+}
+
+// ------------------------ SIGNAL EFFECTS ------------------------ //
+
+// Longest deadline a signal option accepts, so it fits a poll() timeout
+#define MAX_SIGNAL_DEADLINE_MS INT_MAX
+
+// A signalled process whose reaction is being confirmed
+typedef struct SignalTarget {
+    pid_t pid;
+    int pidfd;             // -1 when pidfd_open is unavailable or failed
+    long long sent_ns;
+    long long effect_ns;   // 0 until the effect has been observed
+    int vanished;          // Exited instead of stopping/continuing
+} SignalTarget;
+
+// Signals sent in one go, kept for confirming their effect
+typedef struct SignalBatch {
+    SignalTarget *targets;
+    int count;
+    int sig;
+} SignalBatch;
+
+// Function to open a pidfd for a process (-1 on kernels without pidfd_open)
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+// Function to signal a process through its pidfd when there is one, so a
+// recycled PID cannot receive the signal
+int send_signal(pid_t pid, int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+    if (pidfd >= 0) {
+        return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+    }
+#endif
+    return kill(pid, sig);
+}
 
-    proc->pid = pid;
+// Function to send sig to every PID. With a batch, the targets that can
+// visibly react (not zombies, and for SIGCONT only stopped ones) are recorded.
+// Their state is read and their pidfds opened before the first signal goes
+// out, so the signals themselves are sent back to back.
+void send_signals(const pid_t *pids, int count, int sig, SignalBatch *batch) {
+    char *tracked = NULL;
+
+    if (batch) {
+        batch->targets = malloc((count > 0 ? count : 1) * sizeof(SignalTarget));
+        batch->count = 0;
+        batch->sig = sig;
+        tracked = calloc(count > 0 ? count : 1, 1);
+        if (!tracked) {
+            free(batch->targets);
+            batch->targets = NULL;
+        }
+    }
 
-    sprintf(path, "/proc/%d/stat", pid);
-    fp = fopen(path, "r");
-    if (!fp) {
-        return 0;
+    if (!batch || !batch->targets) {
+        for (int i = 0; i < count; i++) {
+            kill(pids[i], sig);
+        }
+        return;
     }
 
-    if (fgets(buffer, sizeof(buffer), fp)) {
-        // Parse the stat file for process info
-        // Format is: pid (comm) state ppid ...
-        sscanf(buffer, "%d %s %c %d", &proc->pid, comm, &proc->state, &proc->ppid);
-    } else {
-        fclose(fp);
-        return 0;
+    for (int i = 0; i < count; i++) {
+        Process proc;
+        tracked[i] = get_process_info(pids[i], &proc) && proc.state != 'Z' &&
+                     (sig != SIGCONT || proc.state == 'T' || proc.state == 't');
+        if (tracked[i]) {
+            SignalTarget *target = &batch->targets[batch->count++];
+            target->pid = pids[i];
+            target->pidfd = open_pidfd(pids[i]);
+            target->effect_ns = 0;
+            target->vanished = 0;
+        }
     }
 
-    fclose(fp);
-    return 1;
+    SignalTarget *target = batch->targets;
+    for (int i = 0; i < count; i++) {
+        if (!tracked[i]) {
+            kill(pids[i], sig);
+            continue;
+        }
+        target->sent_ns = monotonic_ns();
+        send_signal(target->pid, target->pidfd, sig);
+        target++;
+    }
+    free(tracked);
 }
 
-// Function to check if a process is defunct (zombie)
-int is_defunct(pid_t pid) {
+// Function to check if a signal has visibly taken effect on a process.
+// Sets *vanished if the process exited instead of stopping or continuing.
+int signal_effect_observed(pid_t pid, int sig, int *vanished) {
     Process proc;
+
     if (!get_process_info(pid, &proc)) {
-        return 0;
+        *vanished = (sig != SIGKILL);
+        return 1;
     }
-    return proc.state == 'Z';
+
+    switch (sig) {
+        case SIGKILL: return proc.state == 'Z' || proc.state == 'X';
+        case SIGSTOP: return proc.state == 'T' || proc.state == 't';
+        case SIGCONT: return proc.state != 'T' && proc.state != 't';
+    }
+    return 1;
 }
 
-// Function to check if a given process is an ancestor of another process
-int is_ancestor(pid_t ancestor, pid_t descendant) {
-    if (ancestor == descendant) {
-        return 1;
+// Function to wait until every target reacted or the deadline passed. Exits
+// are reported by the pidfds; other states are sampled from /proc with a
+// backoff, so their latency is an upper bound within the sampling interval.
+void wait_for_signal_effects(SignalBatch *batch, long deadline_ms) {
+    int *pending = malloc((batch->count + 1) * sizeof(int));
+    struct pollfd *fds = malloc((batch->count + 1) * sizeof(struct pollfd));
+    int n_pending = 0;
+    long sleep_us = 50;
+
+    if (!pending || !fds) {
+        perror("Failed to wait for signal effects");
+        free(pending);
+        free(fds);
+        return;
     }
 
-    Process proc;
-    pid_t current = descendant;
+    for (int i = 0; i < batch->count; i++) {
+        pending[n_pending++] = i;
+    }
 
-    while (current > 1) { // PID 1 is init, so we stop there
-        if (!get_process_info(current, &proc)) {
-            return 0;
+    long long deadline_ns = monotonic_ns() + deadline_ms * 1000000LL;
+    while (n_pending > 0) {
+        long long now = monotonic_ns();
+        if (now >= deadline_ns) {
+            break;
         }
 
-        if (proc.ppid == ancestor) {
-            return 1;
+        int nfds = 0;
+        if (batch->sig == SIGKILL) {
+            for (int k = 0; k < n_pending; k++) {
+                if (batch->targets[pending[k]].pidfd >= 0) {
+                    fds[nfds].fd = batch->targets[pending[k]].pidfd;
+                    fds[nfds].events = POLLIN;
+                    fds[nfds].revents = 0;
+                    nfds++;
+                }
+            }
+        }
+
+        if (nfds > 0 && nfds == n_pending) {
+            // Only exits left to wait for: block until one happens
+            long long wait_ms = (deadline_ns - now) / 1000000 + 1;
+            poll(fds, nfds, wait_ms > INT_MAX ? INT_MAX : (int)wait_ms);
+        } else if (nfds > 0) {
+            poll(fds, nfds, 1);
+        } else {
+            struct timespec pause = { 0, sleep_us * 1000 };
+            nanosleep(&pause, NULL);
+            sleep_us = (sleep_us * 2 > 5000) ? 5000 : sleep_us * 2;
         }
 
-        current = proc.ppid;
+        now = monotonic_ns();
+        int kept = 0;
+        int fd_index = 0;
+        for (int k = 0; k < n_pending; k++) {
+            SignalTarget *target = &batch->targets[pending[k]];
+            int done;
+
+            if (batch->sig == SIGKILL && target->pidfd >= 0) {
+                done = fds[fd_index++].revents != 0;
+            } else {
+                done = signal_effect_observed(target->pid, batch->sig, &target->vanished);
+            }
 
-        // Check if we're in a loop (shouldn't happen, but just in case)
-        if (current == proc.pid) {
-            break;
+            if (done) {
+                target->effect_ns = now;
+            } else {
+                pending[kept++] = pending[k];
+            }
         }
+        n_pending = kept;
     }
 
-    return 0;
+    free(pending);
+    free(fds);
 }
 
-// Function to get all processes
-void get_all_processes(Process **processes, int *count) {
-    DIR *dir;
-    struct dirent *entry;
-    pid_t pid;
+// Function to get the name of a signal sent by prct
+const char *signal_name(int sig) {
+    switch (sig) {
+        case SIGKILL: return "SIGKILL";
+        case SIGSTOP: return "SIGSTOP";
+        case SIGCONT: return "SIGCONT";
+        case SIGTERM: return "SIGTERM";
+        case SIGCHLD: return "SIGCHLD";
+    }
+    return "signal";
+}
 
-    *count = 0;
-    *processes = NULL;
+// Function to print p50/p99/max signal-to-effect latency and the stragglers
+void print_signal_effect_report(const SignalBatch *batch, long deadline_ms) {
+    double *latencies = malloc((batch->count + 1) * sizeof(double));
+    int confirmed = 0;
+    int vanished = 0;
+    int stragglers = 0;
 
-    dir = opendir("/proc");
-    if (!dir) {
-        perror("Failed to open /proc");
+    if (!latencies) {
+        perror("Failed to report signal effects");
         return;
     }
 
-    while ((entry = readdir(dir))) {
-        // Check if the entry is a directory and named with digits (process ID)
-        if (entry->d_type == DT_DIR && isdigit(entry->d_name[0])) {
-            pid = atoi(entry->d_name);
+    for (int i = 0; i < batch->count; i++) {
+        const SignalTarget *target = &batch->targets[i];
+        if (!target->effect_ns) {
+            stragglers++;
+        } else if (target->vanished) {
+            vanished++;
+        } else {
+            latencies[confirmed++] = (target->effect_ns - target->sent_ns) / 1e6;
+        }
+    }
 
-            *processes = realloc(*processes, (*count + 1) * sizeof(Process));
-            if (get_process_info(pid, &(*processes)[*count])) {
-                (*count)++;
+    printf("Signal-to-effect (%s): %d confirmed, %d exited, %d straggler(s) after %ld ms\n",
+           signal_name(batch->sig), confirmed, vanished, stragglers, deadline_ms);
+
+    if (confirmed > 0) {
+        qsort(latencies, confirmed, sizeof(double), compare_double);
+        // Nearest-rank percentiles
+        int p50 = (confirmed * 50 + 99) / 100 - 1;
+        int p99 = (confirmed * 99 + 99) / 100 - 1;
+        printf("Latency p50: %.3f ms, p99: %.3f ms, max: %.3f ms\n",
+               latencies[p50], latencies[p99], latencies[confirmed - 1]);
+    }
+
+    if (stragglers > 0) {
+        printf("Stragglers:\n");
+        for (int i = 0; i < batch->count; i++) {
+            if (!batch->targets[i].effect_ns) {
+                printf("%d\n", batch->targets[i].pid);
             }
         }
     }
 
-    closedir(dir);
+    free(latencies);
 }
 
-// Function to get the descendants of a process
-void get_descendants(pid_t root, pid_t **descendants, int *count) {
-    Process *processes;
-    int proc_count;
-
-    *count = 0;
-    *descendants = NULL;
+// Function to wait for, report and release a batch of signals
+void confirm_signal_effects(SignalBatch *batch, long deadline_ms) {
+    if (!batch->targets) {
+        return;
+    }
 
-    get_all_processes(&processes, &proc_count);
+    wait_for_signal_effects(batch, deadline_ms);
+    print_signal_effect_report(batch, deadline_ms);
 
-    // Build the list of descendants
-    for (int i = 0; i < proc_count; i++) {
-        if (processes[i].pid != root && is_ancestor(root, processes[i].pid)) {
-            *descendants = realloc(*descendants, (*count + 1) * sizeof(pid_t));
-            (*descendants)[*count] = processes[i].pid;
-            (*count)++;
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->targets[i].pidfd >= 0) {
+            close(batch->targets[i].pidfd);
         }
     }
-
-    free(processes);
+    free(batch->targets);
+    batch->targets = NULL;
 }
 
-// Function to get the immediate descendants (children) of a process
-void get_immediate_descendants(pid_t parent, pid_t **children, int *count) {
-    Process *processes;
-    int proc_count;
-
-    *count = 0;
-    *children = NULL;
-
-    get_all_processes(&processes, &proc_count);
+// Function to check if a PID must never be terminated by prct: init, prct
+// itself and its parent, the command's root and process_id, and any PID listed
+// in PRCT_PROTECT (comma-separated)
+int is_protected_pid(pid_t pid, pid_t root_pid, pid_t process_id) {
+    if (pid <= 1 || pid == getpid() || pid == getppid() || pid == root_pid || pid == process_id) {
+        return 1;
+    }
 
-    // Find processes with the specified parent
-    for (int i = 0; i < proc_count; i++) {
-        if (processes[i].ppid == parent) {
-            *children = realloc(*children, (*count + 1) * sizeof(pid_t));
-            (*children)[*count] = processes[i].pid;
-            (*count)++;
+    const char *list = getenv("PRCT_PROTECT");
+    while (list && *list) {
+        char *endptr;
+        long protected_pid = strtol(list, &endptr, 10);
+        if (endptr == list) {
+            break;
+        }
+        if (protected_pid == pid) {
+            return 1;
         }
+        list = (*endptr == ',') ? endptr + 1 : endptr;
     }
 
-    free(processes);
+    return 0;
 }
 
-// Function to get non-direct descendants (not immediate children)
-void get_non_direct_descendants(pid_t root, pid_t **descendants, int *count) {
-    pid_t *all_descendants;
-    int all_count;
-    pid_t *immediate;
-    int imm_count;
-
-    *count = 0;
-    *descendants = NULL;
-
-    // Get all descendants
-    get_descendants(root, &all_descendants, &all_count);
+// Function to kill the parents of zombie processes (each parent once, never a
+// protected PID)
+void kill_parents_of_zombies(const SnapshotOptions *snapshot, pid_t root_pid, pid_t root,
+                             SignalBatch *batch) {
+    pid_t *defunct;
+    int defunct_count;
+    int parent_count = 0;
 
-    // Get immediate descendants
-    get_immediate_descendants(root, &immediate, &imm_count);
+    get_defunct_descendants(snapshot, root, &defunct, &defunct_count);
 
-    // Find non-direct descendants (all descendants minus immediate descendants)
-    for (int i = 0; i < all_count; i++) {
-        int is_immediate = 0;
-        for (int j = 0; j < imm_count; j++) {
-            if (all_descendants[i] == immediate[j]) {
-                is_immediate = 1;
-                break;
-            }
+    pid_t *parents = malloc((defunct_count + 1) * sizeof(pid_t));
+    for (int i = 0; parents && i < defunct_count; i++) {
+        Process zombie;
+        if (get_process_info(defunct[i], &zombie) &&
+            !is_protected_pid(zombie.ppid, root_pid, root)) {
+            parents[parent_count++] = zombie.ppid;
         }
+    }
 
-        if (!is_immediate) {
-            *descendants = realloc(*descendants, (*count + 1) * sizeof(pid_t));
-            (*descendants)[*count] = all_descendants[i];
-            (*count)++;
+    if (parents) {
+        qsort(parents, parent_count, sizeof(pid_t), compare_pid);
+        int unique = 0;
+        for (int i = 0; i < parent_count; i++) {
+            if (unique == 0 || parents[unique - 1] != parents[i]) {
+                parents[unique++] = parents[i];
+            }
         }
+        send_signals(parents, unique, SIGKILL, batch);
     }
 
-    free(all_descendants);
-    free(immediate);
+    free(parents);
+    free(defunct);
 }
 
-// Function to get defunct descendants
-void get_defunct_descendants(pid_t root, pid_t **defunct, int *count) {
-    pid_t *descendants;
-    int desc_count;
-
-    *count = 0;
-    *defunct = NULL;
-
-    get_descendants(root, &descendants, &desc_count);
-
-    for (int i = 0; i < desc_count; i++) {
-        if (is_defunct(descendants[i])) {
-            *defunct = realloc(*defunct, (*count + 1) * sizeof(pid_t));
-            (*defunct)[*count] = descendants[i];
-            (*count)++;
+// ------------------------ ZOMBIE TRIAGE ------------------------ //
+
+// A parent that is leaking zombies, with its place in the escalation ladder
+typedef struct ZombieParent {
+    int node;              // Parent index in the snapshot
+    int first;             // Its zombies are zombie_nodes[first .. first + zombies)
+    int zombies;
+    double oldest_age;     // Seconds since the oldest of its zombies started
+    int pidfd;
+    int is_protected;      // Never sent SIGTERM or SIGKILL
+    int resolved_by;       // Signal after which its zombies were gone, 0 while leaking
+} ZombieParent;
+
+// Function to read the system uptime in seconds
+double read_uptime() {
+    FILE *fp = fopen("/proc/uptime", "r");
+    double uptime = 0;
+
+    if (fp) {
+        if (fscanf(fp, "%lf", &uptime) != 1) {
+            uptime = 0;
         }
+        fclose(fp);
     }
-
-    free(descendants);
+    return uptime;
 }
 
-// Function to get the grandchildren of a process
-void get_grandchildren(pid_t root, pid_t **grandchildren, int *count) {
-    pid_t *children;
-    int child_count;
+// Snapshot whose parents are being ranked by compare_zombie_parents
+const ProcessTree *triage_sort_tree;
 
-    *count = 0;
-    *grandchildren = NULL;
+// Function to rank parents by leak count, then by oldest zombie, then by PID
+int compare_zombie_parents(const void *a, const void *b) {
+    const ZombieParent *pa = a;
+    const ZombieParent *pb = b;
+
+    if (pa->zombies != pb->zombies) {
+        return pb->zombies - pa->zombies;
+    }
+    if (pa->oldest_age != pb->oldest_age) {
+        return (pb->oldest_age > pa->oldest_age) - (pb->oldest_age < pa->oldest_age);
+    }
+    return compare_pid(&triage_sort_tree->pid[pa->node], &triage_sort_tree->pid[pb->node]);
+}
 
-    get_immediate_descendants(root, &children, &child_count);
+// Function to order zombie indices by parent (for grouping)
+int compare_zombie_by_parent(const void *a, const void *b) {
+    const ProcessTree *tree = triage_sort_tree;
+    int pa = tree->parent[*(const int *)a];
+    int pb = tree->parent[*(const int *)b];
 
-    for (int i = 0; i < child_count; i++) {
-        pid_t *child_children;
-        int cc_count;
+    if (pa != pb) {
+        return (pa > pb) - (pa < pb);
+    }
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
 
-        get_immediate_descendants(children[i], &child_children, &cc_count);
+// Function to group the zombies below node by parent, ranked by leak count.
+// Everything comes from one snapshot; *zombie_nodes holds the zombie indices.
+int group_zombies_by_parent(const ProcessTree *tree, int node, pid_t root_pid, pid_t process_id,
+                            ZombieParent **parents, int **zombie_nodes) {
+    ProcessSelector zombies = { 'Z', -1 };
+    pid_t *pids;
+    int count;
+    int parent_count = 0;
+
+    *parents = NULL;
+    *zombie_nodes = NULL;
+
+    list_descendants(tree, node, zombies, &pids, &count);
+    *zombie_nodes = malloc((count + 1) * sizeof(int));
+    *parents = malloc((count + 1) * sizeof(ZombieParent));
+    if (!*zombie_nodes || !*parents) {
+        perror("Failed to group zombies");
+        free(pids);
+        return 0;
+    }
 
-        for (int j = 0; j < cc_count; j++) {
-            *grandchildren = realloc(*grandchildren, (*count + 1) * sizeof(pid_t));
-            (*grandchildren)[*count] = child_children[j];
-            (*count)++;
+    for (int i = 0; i < count; i++) {
+        (*zombie_nodes)[i] = find_process_index(tree, pids[i]);
+    }
+    free(pids);
+
+    triage_sort_tree = tree;
+    qsort(*zombie_nodes, count, sizeof(int), compare_zombie_by_parent);
+
+    double uptime = read_uptime();
+    long ticks = sysconf(_SC_CLK_TCK);
+    for (int i = 0; i < count; i++) {
+        int zombie = (*zombie_nodes)[i];
+        double age = tree->details ? uptime - (double)tree->details[zombie].start_ticks / ticks : 0;
+
+        if (i == 0 || tree->parent[zombie] != (*parents)[parent_count - 1].node) {
+            ZombieParent *parent = &(*parents)[parent_count++];
+            pid_t pid = tree->pid[tree->parent[zombie]];
+
+            parent->node = tree->parent[zombie];
+            parent->first = i;
+            parent->zombies = 0;
+            parent->oldest_age = age;
+            parent->pidfd = -1;
+            parent->is_protected = is_protected_pid(pid, root_pid, process_id);
+            parent->resolved_by = 0;
         }
 
-        free(child_children);
+        ZombieParent *parent = &(*parents)[parent_count - 1];
+        parent->zombies++;
+        if (age > parent->oldest_age) {
+            parent->oldest_age = age;
+        }
     }
 
-    free(children);
+    qsort(*parents, parent_count, sizeof(ZombieParent), compare_zombie_parents);
+    return parent_count;
 }
 
-// Function to get siblings of a process
-void get_siblings(pid_t process_id, pid_t **siblings, int *count) {
-    Process proc;
-    pid_t parent;
-
-    *count = 0;
-    *siblings = NULL;
+// Function to check if a parent still has any of its zombies
+int parent_still_leaking(const ProcessTree *tree, const ZombieParent *parent,
+                         const int *zombie_nodes) {
+    pid_t parent_pid = tree->pid[parent->node];
 
-    if (!get_process_info(process_id, &proc)) {
-        return;
+    // Once the parent is gone its zombies are reparented and reaped
+    if (!process_exists(parent_pid)) {
+        return 0;
     }
 
-    parent = proc.ppid;
-
-    Process *processes;
-    int proc_count;
+    for (int i = 0; i < parent->zombies; i++) {
+        Process zombie;
+        if (get_process_info(tree->pid[zombie_nodes[parent->first + i]], &zombie) &&
+            zombie.state == 'Z' && zombie.ppid == parent_pid) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    get_all_processes(&processes, &proc_count);
+// Function to print the parents ranked by leak count
+void print_zombie_triage(const ProcessTree *tree, pid_t process_id, const ZombieParent *parents,
+                         int parent_count) {
+    int total = 0;
+    for (int i = 0; i < parent_count; i++) {
+        total += parents[i].zombies;
+    }
 
-    // Find processes with the same parent
-    for (int i = 0; i < proc_count; i++) {
-        if (processes[i].ppid == parent && processes[i].pid != process_id) {
-            *siblings = realloc(*siblings, (*count + 1) * sizeof(pid_t));
-            (*siblings)[*count] = processes[i].pid;
-            (*count)++;
-        }
+    printf("Zombie triage for %d: %d zombie(s) under %d parent(s)\n", process_id, total,
+           parent_count);
+    if (parent_count == 0) {
+        return;
     }
 
-    free(processes);
+    printf("%8s %8s %10s  %s\n", "parent", "zombies", "oldest_s", "comm");
+    for (int i = 0; i < parent_count; i++) {
+        int node = parents[i].node;
+        printf("%8d %8d %10.1f  %s%s\n", tree->pid[node], parents[i].zombies,
+               parents[i].oldest_age, tree_comm(tree, node),
+               parents[i].is_protected ? " (protected)" : "");
+    }
 }
 
-// Function to get defunct siblings
-void get_defunct_siblings(pid_t process_id, pid_t **defunct_siblings, int *count) {
-    pid_t *siblings;
-    int sib_count;
+// Function to reap zombies by escalating on each distinct parent once per
+// step: SIGCHLD (ask it to reap), then SIGTERM, then SIGKILL, waiting up to
+// step_ms between steps. Protected parents only ever get SIGCHLD.
+void reap_zombie_parents(const ProcessTree *tree, ZombieParent *parents, int parent_count,
+                         const int *zombie_nodes, long step_ms) {
+    static const int ladder[] = { SIGCHLD, SIGTERM, SIGKILL };
+    int remaining = parent_count;
 
-    *count = 0;
-    *defunct_siblings = NULL;
+    for (int i = 0; i < parent_count; i++) {
+        parents[i].pidfd = open_pidfd(tree->pid[parents[i].node]);
+    }
 
-    get_siblings(process_id, &siblings, &sib_count);
+    for (int step = 0; step < 3 && remaining > 0; step++) {
+        int sig = ladder[step];
+        int signalled = 0;
 
-    for (int i = 0; i < sib_count; i++) {
-        if (is_defunct(siblings[i])) {
-            *defunct_siblings = realloc(*defunct_siblings, (*count + 1) * sizeof(pid_t));
-            (*defunct_siblings)[*count] = siblings[i];
-            (*count)++;
+        for (int i = 0; i < parent_count; i++) {
+            if (parents[i].resolved_by || (parents[i].is_protected && sig != SIGCHLD)) {
+                continue;
+            }
+            send_signal(tree->pid[parents[i].node], parents[i].pidfd, sig);
+            signalled++;
+        }
+        if (signalled == 0) {
+            break;
+        }
+
+        // Poll with a backoff until every signalled parent is clean or the step times out
+        long long step_end = monotonic_ns() + step_ms * 1000000LL;
+        long sleep_us = 100;
+        int pending = signalled;
+        while (pending > 0) {
+            struct timespec pause = { 0, sleep_us * 1000 };
+            nanosleep(&pause, NULL);
+            sleep_us = (sleep_us * 2 > 10000) ? 10000 : sleep_us * 2;
+
+            pending = 0;
+            for (int i = 0; i < parent_count; i++) {
+                if (parents[i].resolved_by || (parents[i].is_protected && sig != SIGCHLD)) {
+                    continue;
+                }
+                if (parent_still_leaking(tree, &parents[i], zombie_nodes)) {
+                    pending++;
+                } else {
+                    parents[i].resolved_by = sig;
+                    remaining--;
+                }
+            }
+            if (monotonic_ns() >= step_end) {
+                break;
+            }
         }
+
+        printf("%s: sent to %d parent(s), %d still leaking\n", signal_name(sig), signalled, pending);
     }
 
-    free(siblings);
+    for (int i = 0; i < parent_count; i++) {
+        if (parents[i].pidfd >= 0) {
+            close(parents[i].pidfd);
+        }
+        if (!parents[i].resolved_by) {
+            printf("Unresolved: %d (%d zombie(s))%s\n", tree->pid[parents[i].node],
+                   parents[i].zombies, parents[i].is_protected ? " protected" : "");
+        }
+    }
 }
 
-// Function to kill parents of zombie processes
-void kill_parents_of_zombies(pid_t root) {
-    pid_t *defunct;
-    int defunct_count;
+// Function to run zombie triage below process_id, optionally reaping
+void triage_zombies(const SnapshotOptions *snapshot, pid_t root_pid, pid_t process_id, int reap,
+                    long step_ms) {
+    ProcessTree tree;
+    ZombieParent *parents;
+    int *zombie_nodes;
 
-    get_defunct_descendants(root, &defunct, &defunct_count);
+    if (!snapshot_process_tree(snapshot, &tree)) {
+        return;
+    }
 
-    for (int i = 0; i < defunct_count; i++) {
-        Process zombie;
-        if (get_process_info(defunct[i], &zombie)) {
-            kill(zombie.ppid, SIGKILL);
-        }
+    int node = find_process_index(&tree, process_id);
+    int parent_count = group_zombies_by_parent(&tree, node, root_pid, process_id,
+                                               &parents, &zombie_nodes);
+    print_zombie_triage(&tree, process_id, parents, parent_count);
+    if (reap && parent_count > 0) {
+        reap_zombie_parents(&tree, parents, parent_count, zombie_nodes, step_ms);
     }
 
-    free(defunct);
+    free(parents);
+    free(zombie_nodes);
+    free_process_tree(&tree);
+}
+
+// Function to parse a non-negative integer option argument
+int parse_option_number(const char *str, long *value) {
+    char *endptr;
+
+    *value = strtol(str, &endptr, 10);
+    return *str != '\0' && *endptr == '\0' && *value >= 0;
 }
 
 // Function to handle prct command
 void handle_prct_command(int argc, char *argv[]) {
-    if (argc != 3) { // Ensure we have exactly 3 arguments (excluding the program name itself)
-        fprintf(stderr, "Usage: prct root_pid process_id option\n");
+    if (argc != 3 && argc != 4) { // Ensure we have 3 arguments plus an optional option argument
+        fprintf(stderr, "Usage: prct root_pid process_id option [option_arg]\n");
         return;
     }
 
     char *root_pid_str = argv[0];
     char *process_id_str = argv[1];
     char *option = argv[2];
+    char *option_arg = (argc == 4) ? argv[3] : NULL;
 
     // Check if root_pid_str and process_id_str are valid integers
     char *endptr_root, *endptr_process;
@@ -393,20 +2496,47 @@ void handle_prct_command(int argc, char *argv[]) {
         return;
     }
 
+    // The snapshot cache is opt-in (PRCT_CACHE_TTL_MS) and is never used to
+    // pick the targets of a signal
+    int sends_signals = strcmp(option, "--pz") == 0 || strcmp(option, "-sk") == 0 ||
+                        strcmp(option, "-st") == 0 || strcmp(option, "-dt") == 0 ||
+                        strcmp(option, "-rp") == 0 || strcmp(option, "-zr") == 0;
+    const char *cache_ttl = getenv("PRCT_CACHE_TTL_MS");
+    SnapshotOptions snapshot = { (cache_ttl && !sends_signals) ? atol(cache_ttl) : 0, 0 };
+    const char *repair_budget = getenv("PRCT_REPAIR_BUDGET_MS");
+    if (repair_budget) {
+        snapshot_repair_budget_ms = atol(repair_budget);
+    }
+
+    // Only these options look at names, start times or resource usage; the
+    // rest work on the compact tree arrays alone
+    snapshot.details = strcmp(option, "-tr") == 0 || strcmp(option, "-ta") == 0 ||
+                       strcmp(option, "-ag") == 0 || strcmp(option, "-zt") == 0 ||
+                       strcmp(option, "-zr") == 0 || strcmp(option, "-th") == 0 ||
+                       strcmp(option, "-tl") == 0 || strcmp(option, "-mf") == 0;
+
+    // Signal options take an optional deadline in ms: when given, prct waits
+    // for the targets to react and reports the signal-to-effect latency
+    long deadline_ms = -1;
+    SignalBatch batch = { NULL, 0, 0 };
+    if (sends_signals && option_arg &&
+        (!parse_option_number(option_arg, &deadline_ms) || deadline_ms > MAX_SIGNAL_DEADLINE_MS)) {
+        fprintf(stderr, "Error: deadline must be between 0 and %d milliseconds.\n",
+                MAX_SIGNAL_DEADLINE_MS);
+        return;
+    }
+    SignalBatch *track = (deadline_ms >= 0) ? &batch : NULL;
+
     // Rest of the handle_prct_command function (same as before)
     // Handle options
     if (strcmp(option, "-dc") == 0) {
         // Count defunct descendants
-        pid_t *defunct;
-        int count;
-        get_defunct_descendants(process_id, &defunct, &count);
-        printf("%d\n", count);
-        free(defunct);
+        printf("%d\n", count_defunct_descendants(&snapshot, process_id));
     } else if (strcmp(option, "-ds") == 0) {
         // List non-direct descendants
         pid_t *non_direct;
         int count;
-        get_non_direct_descendants(process_id, &non_direct, &count);
+        get_non_direct_descendants(&snapshot, process_id, &non_direct, &count);
 
         if (count == 0) {
             printf("No non-direct descendants\n");
@@ -420,7 +2550,7 @@ void handle_prct_command(int argc, char *argv[]) {
         // List immediate descendants
         pid_t *immediate;
         int count;
-        get_immediate_descendants(process_id, &immediate, &count);
+        get_immediate_descendants(&snapshot, process_id, &immediate, &count);
 
         if (count == 0) {
             printf("No direct descendants\n");
@@ -434,7 +2564,7 @@ void handle_prct_command(int argc, char *argv[]) {
         // List sibling processes
         pid_t *siblings;
         int count;
-        get_siblings(process_id, &siblings, &count);
+        get_siblings(&snapshot, process_id, &siblings, &count);
 
         if (count == 0) {
             printf("No sibling/s\n");
@@ -448,7 +2578,7 @@ void handle_prct_command(int argc, char *argv[]) {
         // List defunct sibling processes
         pid_t *defunct_siblings;
         int count;
-        get_defunct_siblings(process_id, &defunct_siblings, &count);
+        get_defunct_siblings(&snapshot, process_id, &defunct_siblings, &count);
 
         if (count == 0) {
             printf("No defunct sibling/s\n");
@@ -462,7 +2592,7 @@ void handle_prct_command(int argc, char *argv[]) {
         // List defunct descendants
         pid_t *defunct;
         int count;
-        get_defunct_descendants(process_id, &defunct, &count);
+        get_defunct_descendants(&snapshot, process_id, &defunct, &count);
 
         if (count == 0) {
             printf("No descendant zombie process/es\n");
@@ -476,7 +2606,7 @@ void handle_prct_command(int argc, char *argv[]) {
         // List grandchildren
         pid_t *grandchildren;
         int count;
-        get_grandchildren(process_id, &grandchildren, &count);
+        get_grandchildren(&snapshot, process_id, &grandchildren, &count);
 
         if (count == 0) {
             printf("No grandchildren\n");
@@ -491,50 +2621,175 @@ void handle_prct_command(int argc, char *argv[]) {
         printf("%s\n", is_defunct(process_id) ? "Defunct" : "Not defunct");
     } else if (strcmp(option, "--pz") == 0) {
         // Kill parents of zombie processes
-        kill_parents_of_zombies(process_id);
+        kill_parents_of_zombies(&snapshot, root_pid, process_id, track);
         printf("Parents of zombie processes that are descendants of %d have been killed\n", process_id);
+    } else if (strcmp(option, "-zt") == 0 || strcmp(option, "-zr") == 0) {
+        // Zombie triage: group by parent and rank (-zt), then reap with an
+        // escalation ladder (-zr, option_arg is the per-step deadline in ms)
+        triage_zombies(&snapshot, root_pid, process_id, strcmp(option, "-zr") == 0,
+                       deadline_ms >= 0 ? deadline_ms : 1000);
+        track = NULL; // The ladder reports its own outcome
     } else if (strcmp(option, "-sk") == 0) {
         // Kill all descendants with SIGKILL
         pid_t *descendants;
         int count;
-        get_descendants(process_id, &descendants, &count);
+        get_descendants(&snapshot, process_id, &descendants, &count);
 
-        for (int i = 0; i < count; i++) {
-            kill(descendants[i], SIGKILL);
-        }
+        send_signals(descendants, count, SIGKILL, track);
         printf("All descendants of %d have been killed\n", process_id);
         free(descendants);
     } else if (strcmp(option, "-st") == 0) {
         // Stop all descendants with SIGSTOP
         pid_t *descendants;
         int count;
-        get_descendants(process_id, &descendants, &count);
+        get_descendants(&snapshot, process_id, &descendants, &count);
 
-        for (int i = 0; i < count; i++) {
-            kill(descendants[i], SIGSTOP);
-        }
+        send_signals(descendants, count, SIGSTOP, track);
         printf("All descendants of %d have been stopped\n", process_id);
         free(descendants);
     } else if (strcmp(option, "-dt") == 0) {
         // Continue all stopped descendants with SIGCONT
         pid_t *descendants;
         int count;
-        get_descendants(process_id, &descendants, &count);
+        get_descendants(&snapshot, process_id, &descendants, &count);
 
-        for (int i = 0; i < count; i++) {
-            kill(descendants[i], SIGCONT);
-        }
+        send_signals(descendants, count, SIGCONT, track);
         printf("All stopped descendants of %d have been continued\n", process_id);
         free(descendants);
+    } else if (strcmp(option, "-cd") == 0) {
+        // Count all descendants
+        ProcessTree tree;
+        ProcessSelector all = { 0, -1 };
+        if (!snapshot_process_tree(&snapshot, &tree)) {
+            return;
+        }
+        printf("%ld\n", count_descendants(&tree, find_process_index(&tree, process_id), all));
+        free_process_tree(&tree);
+    } else if (strcmp(option, "-ag") == 0) {
+        // Aggregate states and resources over the subtree of process_id
+        ProcessTree tree;
+        TreeAggregate agg;
+        if (!snapshot_process_tree(&snapshot, &tree)) {
+            return;
+        }
+        aggregate_subtree(&tree, find_process_index(&tree, process_id), reduction_threads(), &agg);
+        printf("Processes: %ld, Threads: %ld\n", agg.processes, agg.threads);
+        printf("Running: %ld, Sleeping: %ld, Disk sleep: %ld, Stopped: %ld, Zombies: %ld\n",
+               agg.running, agg.sleeping, agg.disk_sleep, agg.stopped, agg.zombies);
+        printf("CPU time: %.2f s\n", (double)agg.cpu_ticks / sysconf(_SC_CLK_TCK));
+        printf("Resident memory: %lld KiB\n", agg.rss_pages * (sysconf(_SC_PAGESIZE) / 1024));
+        free_process_tree(&tree);
+    } else if (strcmp(option, "-th") == 0 || strcmp(option, "-tl") == 0) {
+        // Thread states below process_id (-th), or the threads in D or T state (-tl).
+        // /proc/<pid>/task is only read for processes inside the subtree.
+        ProcessTree tree;
+        if (!snapshot_process_tree(&snapshot, &tree)) {
+            return;
+        }
+        int node = find_process_index(&tree, process_id);
+        if (node < 0) {
+            printf("Process %d exited before its threads could be read\n", process_id);
+        } else if (strcmp(option, "-th") == 0) {
+            report_thread_states(&tree, node);
+        } else {
+            Process *threads;
+            int count;
+            list_subtree_threads(&tree, node, "DTt", &threads, &count);
+
+            if (count == 0) {
+                printf("No threads in D or T state\n");
+            } else {
+                for (int i = 0; i < count; i++) {
+                    printf("%d %d %c %s\n", threads[i].ppid, threads[i].pid, threads[i].state,
+                           threads[i].comm);
+                }
+            }
+            free(threads);
+        }
+        free_process_tree(&tree);
+    } else if (strcmp(option, "-rb") == 0) {
+        // Report parallel reduction speedup over the subtree of process_id, or
+        // over a synthetic tree of option_arg processes
+        ProcessTree tree;
+        int ok;
+        if (option_arg) {
+            long size;
+            if (!parse_option_number(option_arg, &size) || size < 1 || size > INT_MAX) {
+                fprintf(stderr, "Error: tree size must be a positive integer.\n");
+                return;
+            }
+            ok = generate_synthetic_tree((int)size, 1, &tree);
+        } else {
+            ok = snapshot_process_tree(&snapshot, &tree);
+        }
+        if (!ok) {
+            return;
+        }
+        int node = find_process_index(&tree, option_arg ? 1 : process_id);
+        if (node >= 0) {
+            report_reduction_speedup(&tree, node);
+        }
+        free_process_tree(&tree);
+    } else if (strcmp(option, "-tr") == 0 || strcmp(option, "-ta") == 0) {
+        // Draw the subtree of process_id (-ta shows every process, -tr collapses
+        // identical leaves); option_arg limits the depth
+        TreeRenderOptions opts = { -1, strcmp(option, "-tr") == 0, 1, 1 };
+        if (option_arg) {
+            long depth;
+            if (!parse_option_number(option_arg, &depth)) {
+                fprintf(stderr, "Error: depth must be a non-negative integer.\n");
+                return;
+            }
+            opts.max_depth = (int)depth;
+        }
+
+        ProcessTree tree;
+        if (!snapshot_process_tree(&snapshot, &tree)) {
+            return;
+        }
+        int node = find_process_index(&tree, process_id);
+        if (node < 0) {
+            printf("Process %d exited before it could be drawn\n", process_id);
+        } else {
+            render_process_tree(&tree, node, &opts, stdout);
+        }
+        fflush(stdout);
+        free_process_tree(&tree);
+    } else if (strcmp(option, "-mf") == 0) {
+        // Report the memory footprint and consistency of a snapshot of the
+        // whole process table
+        static const char *levels[] = { "consistent", "repaired", "inconsistent" };
+        ProcessTree tree;
+        size_t core, lookup, details;
+        if (!snapshot_process_tree(&snapshot, &tree)) {
+            return;
+        }
+        size_t total = process_tree_footprint(&tree, &core, &lookup, &details);
+        printf("Processes: %d\n", tree.count);
+        printf("Tree arrays: %zu bytes\n", core);
+        printf("PID lookup (%s): %zu bytes\n", tree.lookup_direct ? "direct" : "hash", lookup);
+        printf("Details: %zu bytes\n", details);
+        printf("Total: %zu bytes (%.1f per process, %.1f without details)\n", total,
+               tree.count ? (double)total / tree.count : 0.0,
+               tree.count ? (double)(core + lookup) / tree.count : 0.0);
+        printf("Consistency: %s (%d process(es) re-read)\n", levels[tree.consistency],
+               tree.rescanned);
+        free_process_tree(&tree);
     } else if (strcmp(option, "-rp") == 0) {
         // Kill root_process with SIGKILL
-      kill(root_pid, SIGKILL);
-      printf("Root process %d has been killed\n", root_pid);
+        send_signals(&root_pid, 1, SIGKILL, track);
+        printf("Root process %d has been killed\n", root_pid);
     } else {
         printf("Invalid option: %s\n", option);
     }
+
+    if (track) {
+        confirm_signal_effects(track, deadline_ms);
+    }
 }
 
+#ifndef PRCT_LIBRARY
+
 // Function to create the process tree
 void create_process_tree() {
     // Level 1 - First child
@@ -724,62 +2979,17 @@ void *cli_thread(void *arg) {
 
         switch (choice) {
             case 1: {
-                // Show process tree information
-                printf("\nProcess Tree Information:\n");
-                printf("Root PID: %d\n", root_pid);
-
-                if (process_exists(child1_pid)) {
-                    printf("Child 1 PID: %d\n", child1_pid);
-                } else {
-                    printf("Child 1 has terminated\n");
-                }
-
-                if (process_exists(child2_pid)) {
-                    printf("Child 2 PID: %d\n", child2_pid);
-                } else {
-                    printf("Child 2 has terminated\n");
-                }
-
-                if (process_exists(grandchild1_pid)) {
-                    printf("Grandchild 1 PID: %d (has zombie child)\n", grandchild1_pid);
-                } else {
-                    printf("Grandchild 1 has terminated\n");
-                }
-
-                if (process_exists(grandchild2_pid)) {
-                    printf("Grandchild 2 PID: %d (has zombie child)\n", grandchild2_pid);
-                } else {
-                    printf("Grandchild 2 has terminated\n");
-                }
-
-                if (process_exists(grandchild3_pid)) {
-                    printf("Grandchild 3 PID: %d (has zombie child)\n", grandchild3_pid);
-                } else {
-                    printf("Grandchild 3 has terminated\n");
-                }
-
-                if (process_exists(grandchild4_pid)) {
-                    printf("Grandchild 4 PID: %d\n", grandchild4_pid);
-                } else {
-                    printf("Grandchild 4 has terminated\n");
-                }
-
-                printf("Great-grandchild 1 PID: Process under Grandchild 1\n");
-                printf("Great-grandchild 2 PID: Process under Grandchild 4\n");
+                // Show the live process tree below the root
+                ProcessTree tree;
+                SnapshotOptions snapshot = { 0, 1 };
+                TreeRenderOptions opts = { -1, 1, 1, 1 };
 
                 printf("\nProcess Tree Structure:\n");
-                printf("Root (PID: %d)\n", root_pid);
-                printf("|-- Child 1 (PID: %d)\n", child1_pid);
-                printf("|   |-- Grandchild 1 (PID: %d)\n", grandchild1_pid);
-                printf("|   |   |-- Zombie Process\n");
-                printf("|   |   |-- Great-grandchild 1\n");
-                printf("|   |-- Grandchild 2 (PID: %d)\n", grandchild2_pid);
-                printf("|       |-- Zombie Process\n");
-                printf("|-- Child 2 (PID: %d)\n", child2_pid);
-                printf("    |-- Grandchild 3 (PID: %d)\n", grandchild3_pid);
-                printf("    |   |-- Zombie Process\n");
-                printf("    |-- Grandchild 4 (PID: %d)\n", grandchild4_pid);
-                printf("        |-- Great-grandchild 2\n");
+                if (!snapshot_process_tree(&snapshot, &tree)) {
+                    break;
+                }
+                render_process_tree(&tree, find_process_index(&tree, root_pid), &opts, stdout);
+                free_process_tree(&tree);
                 break;
             }
 
@@ -787,9 +2997,15 @@ void *cli_thread(void *arg) {
                 // Run prct command
                 pid_t root_pid_input, process_id_input;
                 char option_input[10];
+                char option_arg_input[20];
+                int fields = 0;
 
-                printf("\nEnter prct command (format: prct root_process process_id option): ");
-                if (scanf("prct %d %d %9s", &root_pid_input, &process_id_input, option_input) == 3) {
+                printf("\nEnter prct command (format: prct root_process process_id option [option_arg]): ");
+                if (fgets(command, sizeof(command), stdin)) {
+                    fields = sscanf(command, "prct %d %d %9s %19s", &root_pid_input, &process_id_input,
+                                    option_input, option_arg_input);
+                }
+                if (fields >= 3) {
                     // Create a temporary argv array to pass to handle_prct_command
                     char root_pid_str[20], process_id_str[20];
 
@@ -797,13 +3013,11 @@ void *cli_thread(void *arg) {
                     snprintf(root_pid_str, sizeof(root_pid_str), "%d", root_pid_input);
                     snprintf(process_id_str, sizeof(process_id_str), "%d", process_id_input);
 
-                    char *prct_argv[] = {root_pid_str, process_id_str, option_input, NULL};
+                    char *prct_argv[] = {root_pid_str, process_id_str, option_input, option_arg_input, NULL};
 
-                    handle_prct_command(3, prct_argv);
+                    handle_prct_command(fields, prct_argv);
                 } else {
-                    fprintf(stderr, "Invalid command format. Use: prct root_process process_id option\n");
-                     while (getchar() != '\n'); // Clear input buffer
-
+                    fprintf(stderr, "Invalid command format. Use: prct root_process process_id option [option_arg]\n");
                 }
                 break;
             }
@@ -822,9 +3036,15 @@ void *cli_thread(void *arg) {
     return NULL;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     pthread_t tid;
 
+    // Run a single prct command when one is given on the command line
+    if (argc > 1) {
+        handle_prct_command(argc - 1, argv + 1);
+        return 0;
+    }
+
     // Set up signal handler
     signal(SIGTERM, handle_sigterm);
     signal(SIGINT, handle_sigterm);
@@ -843,7 +3063,6 @@ int main() {
     sleep(1); // Let processes stabilize. Important!
         printf("Root Process: PID: %d, PPID: %d\n", getpid(), getppid()); // Display PID and PPID
 
-
     // Create a thread for command line interaction
     pthread_create(&tid, NULL, cli_thread, NULL);
 
@@ -862,4 +3081,6 @@ int main() {
     printf("All processes terminated.\n");
 
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // PRCT_LIBRARY
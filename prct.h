@@ -0,0 +1,139 @@
+#ifndef PRCT_H
+#define PRCT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Structure to represent a process
+typedef struct Process {
+    pid_t pid;
+    pid_t ppid;
+    char state;
+    char comm[16];
+    int threads;              // Threads in the group (num_threads)
+    unsigned long long start_ticks;  // Start time after boot, in clock ticks
+    unsigned long cpu_ticks;  // utime + stime
+    long rss_pages;
+} Process;
+
+// Per-process attributes that only some options need, kept apart from the
+// compact tree arrays
+typedef struct ProcessDetails {
+    char comm[16];
+    int threads;
+    unsigned long long start_ticks;
+    unsigned long cpu_ticks;
+    long rss_pages;
+} ProcessDetails;
+
+// Consistency levels of a snapshot's parent links (ProcessTree.consistency).
+// A link holds when the parent is in the snapshot and started before its child.
+#define SNAPSHOT_CONSISTENT 0     // Every link held after the scan
+#define SNAPSHOT_REPAIRED 1       // Broken links were fixed by re-reading those processes
+#define SNAPSHOT_INCONSISTENT 2   // Some links were still broken when the retry budget ran out
+
+// Indexed snapshot of the process table in struct-of-arrays form (13 bytes
+// per process plus the PID lookup table). Processes are stored in depth-first
+// pre-order with siblings in PID order, so the subtree of i is the index range
+// [i, i + subtree_size[i]) and its children are i + 1, then each child c is
+// followed by its next sibling at c + subtree_size[c].
+typedef struct ProcessTree {
+    int count;
+    pid_t *pid;
+    int *parent;              // Index of the parent, or -1 - PPID if it is not in the snapshot
+    int *subtree_size;        // Processes in the subtree rooted at i, including i
+    char *state;
+    ProcessDetails *details;  // NULL unless the snapshot was taken with details
+    int *lookup;              // PID -> index, direct-mapped or open addressing
+    unsigned int lookup_size;
+    int lookup_direct;
+    int consistency;          // SNAPSHOT_CONSISTENT, _REPAIRED or _INCONSISTENT
+    int rescanned;            // Processes re-read to repair parent links
+} ProcessTree;
+
+// Per-call settings for snapshot_process_tree()
+typedef struct SnapshotOptions {
+    long cache_ttl_ms;    // Reuse a shared snapshot at most this old, or 0 to always scan
+    int details;          // Keep ProcessDetails (comm, threads, start time, CPU, RSS)
+} SnapshotOptions;
+
+// Options for the process tree renderer
+typedef struct TreeRenderOptions {
+    int max_depth;        // Levels drawn below the root, or -1 for no limit
+    int compact;          // Collapse identical leaf siblings into "N*[comm]"
+    int show_counts;      // Append the number of descendants to inner nodes
+    int show_threads;     // Append each process's thread count as "{N}" (needs details)
+} TreeRenderOptions;
+
+// Generic reduction over a subtree: init sets a value to the identity, map
+// folds one process into a value and combine folds (and consumes) another
+// partial value. Operators must be associative so results do not depend on
+// how the subtree was split between threads.
+typedef struct TreeReduction {
+    size_t value_size;
+    void (*init)(void *value, void *ctx);
+    void (*map)(const ProcessTree *tree, int node, void *value, void *ctx);
+    void (*combine)(void *value, void *other, void *ctx);
+    void *ctx;
+} TreeReduction;
+
+// Which processes a count or list reduction selects
+typedef struct ProcessSelector {
+    char state;           // Only processes in this state, or 0 for any state
+    int exclude_parent;   // Skip children of this index (-1 to keep all)
+} ProcessSelector;
+
+// Resource and state totals over a subtree
+typedef struct TreeAggregate {
+    long processes;
+    long running;
+    long sleeping;
+    long disk_sleep;
+    long stopped;
+    long zombies;
+    long threads;
+    unsigned long long cpu_ticks;
+    long long rss_pages;
+} TreeAggregate;
+
+// qsort comparators
+int compare_process_pid(const void *a, const void *b);
+int compare_double(const void *a, const void *b);
+
+// Snapshot of /proc
+int get_process_info(pid_t pid, Process *proc);
+int is_defunct(pid_t pid);
+void get_all_processes(Process **processes, int *count);
+int build_process_tree(Process *processes, int count, int keep_details, ProcessTree *tree);
+int snapshot_process_tree(const SnapshotOptions *opts, ProcessTree *tree);
+void free_process_tree(ProcessTree *tree);
+int find_process_index(const ProcessTree *tree, pid_t pid);
+pid_t tree_ppid(const ProcessTree *tree, int node);
+const char *tree_comm(const ProcessTree *tree, int node);
+size_t process_tree_footprint(const ProcessTree *tree, size_t *core, size_t *lookup,
+                              size_t *details);
+int generate_synthetic_tree(int count, unsigned int seed, ProcessTree *tree);
+
+// Rendering
+void render_process_tree(const ProcessTree *tree, int node, const TreeRenderOptions *opts,
+                         FILE *out);
+
+// Subtree reductions
+int reduction_threads();
+void parallel_reduce(const ProcessTree *tree, int node, int include_root,
+                     const TreeReduction *red, int threads, void *value);
+long count_descendants(const ProcessTree *tree, int node, ProcessSelector sel);
+void list_descendants(const ProcessTree *tree, int node, ProcessSelector sel,
+                      pid_t **pids, int *count);
+void aggregate_subtree(const ProcessTree *tree, int node, int threads, TreeAggregate *agg);
+
+// Relatives of a snapshot node
+void list_children(const ProcessTree *tree, int node, pid_t **children, int *count);
+void list_grandchildren(const ProcessTree *tree, int node, pid_t **grandchildren, int *count);
+void list_siblings(const ProcessTree *tree, int node, char state, pid_t **siblings, int *count);
+
+// Command line entry point: root_pid process_id option [option_arg]
+void handle_prct_command(int argc, char *argv[]);
+
+#endif
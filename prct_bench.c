@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "prct.h"
+
+// prct_bench - runs every prct query option against synthetic trees of
+// increasing size (and the snapshot scan against the live /proc) and writes
+// one tab-separated row per (option, nodes) so results can be diffed or
+// compared between versions.
+//
+// Usage: prct_bench [-s sizes] [-n reps] [-o output] [-c baseline] [-t percent]
+//   -s  comma-separated tree sizes (default 100,10000,100000,1000000)
+//   -n  repetitions per row (default scales from 101 down to 5 with size)
+//   -o  write the results to a file instead of stdout
+//   -c  compare medians with an earlier results file and exit with status 1
+//       if any row got slower by more than -t percent (default 10)
+//
+// Each row runs in a forked child so its memory use belongs to that row alone.
+// The "scan" row (nodes 0) times a full snapshot of the live /proc.
+// syscalls is the number of system calls (of any kind) one run makes,
+// counted by tracing one extra, untimed run with ptrace; -1 if ptrace is not
+// permitted. extra_rss_kb is how far the resident set peaked above the
+// prepared tree during the timed runs (the high-water mark is reset through
+// /proc/self/clear_refs once the tree is built); -1 if it cannot be read.
+// -c also flags rows whose syscall count or extra_rss_kb grew by more than
+// -t percent.
+
+#define BENCH_FORMAT_VERSION 3
+#define BENCH_RSS_SLACK_KB 256
+#define MAX_SIZES 16
+#define MAX_ROWS 256
+
+// A benchmarked option: root is the tree root, node a child of the root
+typedef struct BenchOption {
+    const char *name;
+    void (*run)(const ProcessTree *tree, int root, int node);
+} BenchOption;
+
+// One result row, also used for baseline comparison
+typedef struct BenchRow {
+    char option[16];
+    long nodes;
+    double median_us;
+    long syscalls;
+    long extra_rss_kb;
+} BenchRow;
+
+FILE *bench_null;
+volatile long bench_sink;
+
+void run_dc(const ProcessTree *tree, int root, int node) {
+    ProcessSelector zombies = { 'Z', -1 };
+    bench_sink += count_descendants(tree, root, zombies);
+}
+
+void run_list(const ProcessTree *tree, int root, ProcessSelector sel) {
+    pid_t *pids;
+    int count;
+
+    list_descendants(tree, root, sel, &pids, &count);
+    bench_sink += count;
+    free(pids);
+}
+
+void run_ds(const ProcessTree *tree, int root, int node) {
+    ProcessSelector non_direct = { 0, root };
+    run_list(tree, root, non_direct);
+}
+
+void run_df(const ProcessTree *tree, int root, int node) {
+    ProcessSelector zombies = { 'Z', -1 };
+    run_list(tree, root, zombies);
+}
+
+void run_id(const ProcessTree *tree, int root, int node) {
+    pid_t *pids;
+    int count;
+
+    list_children(tree, root, &pids, &count);
+    bench_sink += count;
+    free(pids);
+}
+
+void run_gc(const ProcessTree *tree, int root, int node) {
+    pid_t *pids;
+    int count;
+
+    list_grandchildren(tree, root, &pids, &count);
+    bench_sink += count;
+    free(pids);
+}
+
+void run_lg(const ProcessTree *tree, int root, int node) {
+    pid_t *pids;
+    int count;
+
+    list_siblings(tree, node, 0, &pids, &count);
+    bench_sink += count;
+    free(pids);
+}
+
+void run_lz(const ProcessTree *tree, int root, int node) {
+    pid_t *pids;
+    int count;
+
+    list_siblings(tree, node, 'Z', &pids, &count);
+    bench_sink += count;
+    free(pids);
+}
+
+// -do reads the process's stat file directly rather than using the snapshot
+void run_do(const ProcessTree *tree, int root, int node) {
+    bench_sink += is_defunct(tree->pid[node]);
+}
+
+void run_cd(const ProcessTree *tree, int root, int node) {
+    ProcessSelector all = { 0, -1 };
+    bench_sink += count_descendants(tree, root, all);
+}
+
+void run_ag(const ProcessTree *tree, int root, int node) {
+    TreeAggregate agg;
+    aggregate_subtree(tree, root, reduction_threads(), &agg);
+    bench_sink += agg.processes;
+}
+
+void run_tr(const ProcessTree *tree, int root, int node) {
+    TreeRenderOptions opts = { -1, 1, 1, 1 };
+    render_process_tree(tree, root, &opts, bench_null);
+}
+
+// Processes of the benchmarked tree in PID order, as a /proc scan returns them
+Process *bench_processes;
+
+// Function to turn a snapshot back into the process array it was built from
+void unpack_process_tree(const ProcessTree *tree) {
+    bench_processes = malloc((tree->count + 1) * sizeof(Process));
+    if (!bench_processes) {
+        return;
+    }
+
+    for (int i = 0; i < tree->count; i++) {
+        Process *proc = &bench_processes[i];
+        memset(proc, 0, sizeof(*proc));
+        proc->pid = tree->pid[i];
+        proc->ppid = tree_ppid(tree, i);
+        proc->state = tree->state[i];
+        if (tree->details) {
+            const ProcessDetails *det = &tree->details[i];
+            memcpy(proc->comm, det->comm, sizeof(proc->comm));
+            proc->threads = det->threads;
+            proc->start_ticks = det->start_ticks;
+            proc->cpu_ticks = det->cpu_ticks;
+            proc->rss_pages = det->rss_pages;
+        }
+    }
+    qsort(bench_processes, tree->count, sizeof(Process), compare_process_pid);
+}
+
+// Indexing cost: rebuild the tree from a copy of its processes
+void run_index(const ProcessTree *tree, int root, int node) {
+    Process *copy = malloc((tree->count + 1) * sizeof(Process));
+    ProcessTree rebuilt;
+
+    memcpy(copy, bench_processes, tree->count * sizeof(Process));
+    build_process_tree(copy, tree->count, tree->details != NULL, &rebuilt);
+    bench_sink += rebuilt.count;
+    free_process_tree(&rebuilt);
+}
+
+const BenchOption bench_options[] = {
+    { "-dc", run_dc }, { "-ds", run_ds }, { "-id", run_id }, { "-lg", run_lg },
+    { "-lz", run_lz }, { "-df", run_df }, { "-gc", run_gc }, { "-do", run_do },
+    { "-cd", run_cd }, { "-ag", run_ag }, { "-tr", run_tr }, { "index", run_index },
+};
+
+// Function to run one repetition of a row
+void bench_once(const BenchOption *option, const ProcessTree *tree, long nodes, int root,
+                int node) {
+    if (nodes > 0) {
+        option->run(tree, root, node);
+    } else {
+        // Live row: the full snapshot a prct invocation pays for
+        ProcessTree live;
+        SnapshotOptions snapshot = { 0, 1 };
+        snapshot_process_tree(&snapshot, &live);
+        bench_sink += live.count;
+        free_process_tree(&live);
+    }
+}
+
+// Function to count the system calls of one repetition by running it in a
+// traced child that stops at every syscall entry and exit (-1 if ptrace fails)
+long count_syscalls(const BenchOption *option, const ProcessTree *tree, long nodes, int root,
+                    int node) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
+            _exit(1);
+        }
+        raise(SIGSTOP);
+        bench_once(option, tree, nodes, root, node);
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status) ||
+        ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)PTRACE_O_TRACESYSGOOD) < 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    long stops = 0;
+    int sig = 0;
+    while (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) == 0 &&
+           waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            stops++;
+            sig = 0;
+        } else {
+            sig = WSTOPSIG(status);
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    // One entry and one exit stop per call, less the exit of the kill()
+    // behind raise(SIGSTOP) and the entry of the final exit_group()
+    return (stops - 2) / 2;
+}
+
+double elapsed_us(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Function to read a "<field>: <n> kB" line of /proc/self/status (-1 if missing)
+long read_status_kb(const char *field) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[256];
+    size_t len = strlen(field);
+    long kb = -1;
+
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+// Function to reset the peak RSS to the current RSS; returns the current RSS
+// in kB, or -1 if the kernel does not support resetting it
+long reset_peak_rss() {
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+
+    if (!fp) {
+        return -1;
+    }
+    int ok = fputs("5", fp) >= 0;
+    if (fclose(fp) != 0 || !ok) {
+        return -1;
+    }
+    return read_status_kb("VmRSS");
+}
+
+// Function to time one option and format its result row (runs in a child)
+void bench_row(const BenchOption *option, long nodes, int reps, char *row, size_t size) {
+    ProcessTree tree;
+    SnapshotOptions snapshot = { 0, 1 };
+    int ok;
+
+    if (nodes > 0) {
+        ok = generate_synthetic_tree((int)nodes, 1, &tree);
+    } else {
+        ok = snapshot_process_tree(&snapshot, &tree);
+    }
+    if (!ok) {
+        snprintf(row, size, "%s\t%ld\tfailed\n", option->name, nodes);
+        return;
+    }
+
+    int root = find_process_index(&tree, 1);
+    int node = (root >= 0 && tree.subtree_size[root] > 1) ? root + 1 : root;
+    double *samples = malloc(reps * sizeof(double));
+    if (option->run == run_index) {
+        unpack_process_tree(&tree);
+    }
+
+    // Only memory the option itself uses counts, not the prepared tree
+    long prepared_kb = reset_peak_rss();
+
+    for (int i = 0; i < reps; i++) {
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bench_once(option, &tree, nodes, root, node);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[i] = elapsed_us(&start, &end);
+    }
+
+    long peak_kb = read_status_kb("VmHWM");
+    long extra_rss_kb = (prepared_kb >= 0 && peak_kb >= prepared_kb) ? peak_kb - prepared_kb : -1;
+    long syscalls = count_syscalls(option, &tree, nodes, root, node);
+
+    qsort(samples, reps, sizeof(double), compare_double);
+    int p50 = (reps * 50 + 99) / 100 - 1;
+    int p99 = (reps * 99 + 99) / 100 - 1;
+    snprintf(row, size, "%s\t%ld\t%d\t%.1f\t%.1f\t%ld\t%ld\n", option->name, nodes, reps,
+             samples[p50], samples[p99], syscalls, extra_rss_kb);
+
+    free(samples);
+    free(bench_processes);
+    free_process_tree(&tree);
+}
+
+// Function to run one row in a forked child and collect its output line
+int run_row_isolated(const BenchOption *option, long nodes, int reps, char *row, size_t size) {
+    int fds[2];
+
+    fflush(NULL);
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 0;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        bench_null = fopen("/dev/null", "w");
+        bench_row(option, nodes, reps, row, size);
+        if (write(fds[1], row, strlen(row)) < 0) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    ssize_t total = 0, n;
+    while (total < (ssize_t)size - 1 && (n = read(fds[0], row + total, size - 1 - total)) > 0) {
+        total += n;
+    }
+    row[total] = '\0';
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return total > 0;
+}
+
+// Function to load the rows of an earlier results file
+int load_baseline(const char *path, BenchRow *rows, int max_rows) {
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int count = 0;
+    int version = 0;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    while (count < max_rows && fgets(line, sizeof(line), fp)) {
+        BenchRow *row = &rows[count];
+        if (sscanf(line, "# prct_bench v%d", &version) == 1 || line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%15s %ld %*d %lf %*f %ld %ld", row->option, &row->nodes,
+                   &row->median_us, &row->syscalls, &row->extra_rss_kb) == 5) {
+            // Before v2 that column only counted read/write calls, and before
+            // v3 the last one was the peak RSS including the prepared tree
+            if (version < 2) {
+                row->syscalls = -1;
+            }
+            if (version < 3) {
+                row->extra_rss_kb = -1;
+            }
+            count++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    long sizes[MAX_SIZES] = { 100, 10000, 100000, 1000000 };
+    int size_count = 4;
+    int reps = 0;
+    const char *output = NULL;
+    const char *baseline_path = NULL;
+    double threshold = 10.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:o:c:t:")) != -1) {
+        switch (opt) {
+            case 's': {
+                size_count = 0;
+                for (char *tok = strtok(optarg, ","); tok && size_count < MAX_SIZES;
+                     tok = strtok(NULL, ",")) {
+                    sizes[size_count++] = atol(tok);
+                }
+                break;
+            }
+            case 'n': reps = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 'c': baseline_path = optarg; break;
+            case 't': threshold = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s sizes] [-n reps] [-o output] [-c baseline] [-t percent]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+
+    BenchRow baseline[MAX_ROWS];
+    int baseline_count = 0;
+    if (baseline_path && (baseline_count = load_baseline(baseline_path, baseline, MAX_ROWS)) < 0) {
+        return 2;
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror(output);
+        return 2;
+    }
+
+    fprintf(out, "# prct_bench v%d threads=%d\n", BENCH_FORMAT_VERSION, reduction_threads());
+    fprintf(out, "# option\tnodes\treps\tmedian_us\tp99_us\tsyscalls\textra_rss_kb\n");
+
+    int regressions = 0;
+    int option_count = sizeof(bench_options) / sizeof(bench_options[0]);
+    BenchOption scan = { "scan", NULL };
+
+    // nodes == 0 is the live /proc scan, run once after the synthetic sizes
+    for (int s = 0; s <= size_count; s++) {
+        long nodes = (s < size_count) ? sizes[s] : 0;
+        int row_reps = reps;
+        if (row_reps <= 0) {
+            long scaled = (nodes > 0) ? 1000000 / nodes : 21;
+            row_reps = scaled > 101 ? 101 : scaled < 5 ? 5 : (int)scaled;
+        }
+
+        for (int o = 0; o < (nodes > 0 ? option_count : 1); o++) {
+            const BenchOption *option = (nodes > 0) ? &bench_options[o] : &scan;
+            char row[256];
+
+            if (!run_row_isolated(option, nodes, row_reps, row, sizeof(row))) {
+                fprintf(stderr, "%s at %ld nodes failed\n", option->name, nodes);
+                continue;
+            }
+            fputs(row, out);
+            fflush(out);
+
+            BenchRow current;
+            if (sscanf(row, "%15s %ld %*d %lf %*f %ld %ld", current.option, &current.nodes,
+                       &current.median_us, &current.syscalls, &current.extra_rss_kb) != 5) {
+                continue;
+            }
+            for (int b = 0; b < baseline_count; b++) {
+                if (strcmp(baseline[b].option, current.option) == 0 &&
+                    baseline[b].nodes == current.nodes && baseline[b].median_us > 0) {
+                    double change = (current.median_us / baseline[b].median_us - 1) * 100;
+                    // Ignore sub-microsecond jitter on the trivial queries
+                    if (change > threshold && current.median_us - baseline[b].median_us > 1.0) {
+                        fprintf(stderr, "REGRESSION %s at %ld nodes: %.1f us -> %.1f us (+%.0f%%)\n",
+                                current.option, current.nodes, baseline[b].median_us,
+                                current.median_us, change);
+                        regressions++;
+                    }
+                    // Syscall counts are exact, so any growth beyond -t percent counts
+                    if (baseline[b].syscalls >= 0 && current.syscalls >= 0 &&
+                        current.syscalls > baseline[b].syscalls * (1 + threshold / 100)) {
+                        fprintf(stderr, "REGRESSION %s at %ld nodes: %ld -> %ld syscalls\n",
+                                current.option, current.nodes, baseline[b].syscalls,
+                                current.syscalls);
+                        regressions++;
+                    }
+                    // Allocations land in whole pages, so small growth is noise
+                    if (baseline[b].extra_rss_kb >= 0 && current.extra_rss_kb >= 0 &&
+                        current.extra_rss_kb > baseline[b].extra_rss_kb * (1 + threshold / 100) &&
+                        current.extra_rss_kb - baseline[b].extra_rss_kb > BENCH_RSS_SLACK_KB) {
+                        fprintf(stderr, "REGRESSION %s at %ld nodes: %ld KB -> %ld KB extra RSS\n",
+                                current.option, current.nodes, baseline[b].extra_rss_kb,
+                                current.extra_rss_kb);
+                        regressions++;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return regressions > 0;
+}